@@ -0,0 +1,302 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tt.h"
+
+// Persistent analysis store: search results kept in a memory-mapped file, so that
+// they survive restarts and are shared by all engine processes using the file.
+//
+// The file is a header followed by a fixed number of buckets laid out like the
+// transposition table's: two (key ^ data, data) slots, one kept for the deepest
+// result and one always replaced. Processes read and write the mapping directly
+// with atomic 64-bit accesses. A slot torn by a concurrent writer or by a crash
+// fails its key check and reads as empty, so no write needs a lock or a log.
+//
+// The file never grows; its size is the cap. Reopening it with another size
+// compacts it: the deepest entries are copied into a new file that replaces the
+// old one by rename, so a crash leaves either file intact. The old file is then
+// marked retired, and processes still mapping it switch to the new one on their
+// next probe or store. Results they stored in the old file while it was being
+// copied are lost.
+
+const char ANALYSIS_MAGIC[8] = {'T', 'T', 'T', 'A', 'N', 'A', '0', '1'};
+const size_t DEFAULT_ANALYSIS_MB = 64;
+
+// Only results of at least this many plies are shared; shallower ones are cheaper
+// to search again than to keep.
+const int ANALYSIS_MIN_DEPTH = 2;
+
+class AnalysisStore {
+public:
+    AnalysisStore() = default;
+    AnalysisStore(const AnalysisStore&) = delete;
+    AnalysisStore& operator=(const AnalysisStore&) = delete;
+
+    ~AnalysisStore() {
+        for (const auto& r : regions) {
+            munmap(r->map, r->length);
+        }
+    }
+
+    // Maps the file, creating it if it is missing. With megabytes 0 an existing
+    // file keeps its size and a new one gets DEFAULT_ANALYSIS_MB. False if the file
+    // is not a store or cannot be mapped.
+    bool open(const std::string& path, size_t megabytes = 0) {
+        filePath = path;
+        return openFile(megabytes);
+    }
+
+    bool isOpen() const {
+        return current.load(std::memory_order_acquire) != nullptr;
+    }
+
+    size_t sizeInBytes() const {
+        const region* r = current.load(std::memory_order_acquire);
+        return r != nullptr ? r->length : 0;
+    }
+
+    bool probe(uint64_t key, ttEntry& entry) {
+        const region* r = live();
+        const bucket& b = r->buckets[key & r->mask];
+        for (const auto& s : b.slots) {
+            uint64_t data = s.data.load(std::memory_order_relaxed);
+            uint64_t check = s.key.load(std::memory_order_relaxed);
+            if (data != 0 && (check ^ data) == key) {
+                TranspositionTable::unpack(data, entry);
+                hitCount.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(uint64_t key, int depth, Bound bound, int score, int moveX, int moveY) {
+        const region* r = live();
+        store(r->buckets[key & r->mask], key, TranspositionTable::pack(depth, bound, score, moveX, moveY));
+        storeCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Occupied slots, counted by scanning the file.
+    size_t count() const {
+        const region* r = current.load(std::memory_order_acquire);
+        size_t n = 0;
+        for (size_t i = 0; r != nullptr && i <= r->mask; ++i) {
+            for (const auto& s : r->buckets[i].slots) {
+                uint64_t data = s.data.load(std::memory_order_relaxed);
+                n += data != 0 && s.key.load(std::memory_order_relaxed) != data;
+            }
+        }
+        return n;
+    }
+
+    // Probes answered and results stored by this process.
+    uint64_t hits() const {
+        return hitCount.load(std::memory_order_relaxed);
+    }
+
+    uint64_t stores() const {
+        return storeCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct header {
+        char magic[8];
+        uint64_t buckets;
+        std::atomic<uint64_t> retired; // set once a compacted file has replaced this one
+        uint64_t reserved[5];
+    };
+    struct slot {
+        std::atomic<uint64_t> key{0}, data{0};
+    };
+    struct bucket {
+        slot slots[2];
+    };
+    // One mapping of the file.
+    struct region {
+        void* map;
+        size_t length;
+        bucket* buckets;
+        size_t mask;
+
+        header* head() const {
+            return static_cast<header*>(map);
+        }
+    };
+
+    static_assert(sizeof(header) == 64 && sizeof(bucket) == 32, "store layout is part of the file format");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "slots are shared between processes");
+
+    std::string filePath;
+    // The mapping in use. Mappings replaced after a compaction stay mapped until
+    // the store is destroyed, as other threads may still be reading them.
+    std::atomic<region*> current{nullptr};
+    std::vector<std::unique_ptr<region>> regions;
+    std::mutex remapMutex;
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> storeCount{0};
+
+    // The current mapping, after switching to the file that replaced it if it
+    // has been retired by a compaction.
+    const region* live() {
+        region* r = current.load(std::memory_order_acquire);
+        if (r->head()->retired.load(std::memory_order_relaxed) == 0) {
+            return r;
+        }
+        std::lock_guard<std::mutex> lock(remapMutex);
+        if (current.load(std::memory_order_acquire) == r) {
+            openFile(0); // on failure, keep using the retired file
+        }
+        return current.load(std::memory_order_acquire);
+    }
+
+    bool openFile(size_t megabytes) {
+        const std::string& path = filePath;
+        // another process may replace the file while we wait for its lock; then the
+        // locked inode is stale and we start over
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat locked, current;
+            if (flock(fd, LOCK_EX) != 0 || fstat(fd, &locked) != 0) {
+                ::close(fd);
+                return false;
+            }
+            if (stat(path.c_str(), &current) != 0 || current.st_ino != locked.st_ino) {
+                ::close(fd);
+                continue;
+            }
+            bool ok = openLocked(fd, path, locked.st_size, megabytes);
+            // a mapping keeps the open file, and with it the lock, alive after close
+            flock(fd, LOCK_UN);
+            ::close(fd);
+            return ok;
+        }
+        return false;
+    }
+
+    static size_t bucketsFor(size_t megabytes) {
+        size_t n = 1;
+        while (n * 2 * sizeof(bucket) <= megabytes * 1024 * 1024) {
+            n *= 2;
+        }
+        return n;
+    }
+
+    static size_t fileSize(size_t bucketCount) {
+        return sizeof(header) + bucketCount * sizeof(bucket);
+    }
+
+    static void store(bucket& b, uint64_t key, uint64_t data) {
+        slot& deep = b.slots[0];
+        uint64_t deepData = deep.data.load(std::memory_order_relaxed);
+        bool same = (deep.key.load(std::memory_order_relaxed) ^ deepData) == key;
+        slot& target = deepData == 0 || same || (data >> 56) >= (deepData >> 56) ? deep : b.slots[1];
+        target.key.store(key ^ data, std::memory_order_relaxed);
+        target.data.store(data, std::memory_order_relaxed);
+    }
+
+    // Maps a writable file of the given size; nullptr on failure.
+    static void* mapFile(int fd, size_t size) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    bool openLocked(int fd, const std::string& path, size_t size, size_t megabytes) {
+        if (size == 0) {
+            // just created by us: build it aside and rename it in place
+            return rebuild(path, bucketsFor(megabytes ? megabytes : DEFAULT_ANALYSIS_MB), nullptr, 0);
+        }
+        header h;
+        if (size < sizeof(header) || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)
+            || std::memcmp(h.magic, ANALYSIS_MAGIC, sizeof(ANALYSIS_MAGIC)) != 0
+            || h.buckets == 0 || (h.buckets & (h.buckets - 1)) != 0 || size != fileSize(h.buckets)) {
+            return false;
+        }
+        if (megabytes != 0 && bucketsFor(megabytes) != h.buckets) {
+            void* old = mapFile(fd, size);
+            if (old == nullptr) {
+                return false;
+            }
+            bool ok = rebuild(path, bucketsFor(megabytes), reinterpret_cast<bucket*>(static_cast<header*>(old) + 1),
+                              h.buckets);
+            if (ok) {
+                // processes still mapping the old file move over to the new one
+                static_cast<header*>(old)->retired.store(1, std::memory_order_release);
+            }
+            munmap(old, size);
+            return ok;
+        }
+        return attach(mapFile(fd, size), size);
+    }
+
+    bool attach(void* p, size_t size) {
+        if (p == nullptr) {
+            return false;
+        }
+        header* h = static_cast<header*>(p);
+        regions.push_back(std::unique_ptr<region>(new region{p, size, reinterpret_cast<bucket*>(h + 1), h->buckets - 1}));
+        current.store(regions.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    // Writes a store of bucketCount buckets holding the deepest entries of the old
+    // buckets to a temporary file, then renames it over path and maps it.
+    bool rebuild(const std::string& path, size_t bucketCount, const bucket* old, size_t oldCount) {
+        std::string temporary = path + ".tmp" + std::to_string(getpid());
+        int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        size_t size = fileSize(bucketCount);
+        void* p = ftruncate(fd, size) == 0 ? mapFile(fd, size) : nullptr;
+        if (p == nullptr) {
+            ::close(fd);
+            unlink(temporary.c_str());
+            return false;
+        }
+        header* h = static_cast<header*>(p);
+        std::memcpy(h->magic, ANALYSIS_MAGIC, sizeof(ANALYSIS_MAGIC));
+        h->buckets = bucketCount;
+        bucket* fresh = reinterpret_cast<bucket*>(h + 1);
+
+        std::vector<std::pair<uint64_t, uint64_t>> entries; // (data, key), deepest last after sorting
+        for (size_t i = 0; i < oldCount; ++i) {
+            for (const auto& s : old[i].slots) {
+                uint64_t data = s.data.load(std::memory_order_relaxed);
+                uint64_t key = s.key.load(std::memory_order_relaxed) ^ data;
+                if (data != 0) {
+                    entries.push_back({data, key});
+                }
+            }
+        }
+        // shallow entries first, so that deeper ones win the slots they contend for
+        std::sort(entries.begin(), entries.end());
+        for (const auto& e : entries) {
+            store(fresh[e.second & (bucketCount - 1)], e.second, e.first);
+        }
+        bool ok = msync(p, size, MS_SYNC) == 0 && fsync(fd) == 0
+               && rename(temporary.c_str(), path.c_str()) == 0;
+        ::close(fd);
+        if (!ok) {
+            munmap(p, size);
+            unlink(temporary.c_str());
+            return false;
+        }
+        return attach(p, size);
+    }
+};
@@ -0,0 +1,448 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+
+#include "ttt.h"
+
+// Engine-vs-engine self-play. Two engine configurations, A and B, play every
+// opening twice with colours swapped; games run in parallel, one per worker
+// thread, and are streamed to a CSV log as they finish:
+//     g++ -O2 arena.cpp -o arena -pthread
+//     ./arena --games 1000 --a depth=4 --b depth=3 --log games.csv --sprt 0,10
+// The summary gives A's score, the Elo difference with its 95% interval, the
+// likelihood of superiority, the SPRT verdict and games per minute per core.
+
+struct engineSettings {
+    searchLimits limits;
+    size_t hashMb = 4;
+    std::string weights; // weights file, compiled-in weights if empty
+    std::shared_ptr<const OpeningBook> book;
+};
+
+struct arenaOptions {
+    int boardSize = 15;
+    int toWin = 5;
+    int games = 100;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int openingPlies = 3;  // of the random openings
+    int maxPlies = 0;      // draw after that many plies, 0 for a full board
+    uint32_t seed = 1;
+    std::string openings;  // file of move lists, one opening per line
+    std::string log;
+    bool sprt = false;
+    double elo0 = 0, elo1 = 10, alpha = 0.05, beta = 0.05;
+    engineSettings engines[2];
+};
+
+// One finished game. Moves, times and nodes include the opening, whose moves
+// have zero time and nodes.
+struct gameRecord {
+    int index;
+    int opening;
+    int engineX;   // 0 if A played X
+    int winner;    // 0 for A, 1 for B, -1 for a draw
+    std::vector<std::pair<int, int>> moves;
+    std::vector<uint64_t> micros, nodes;
+    double seconds = 0;
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --a SPEC         settings of engine A, e.g. depth=4,time=0,nodes=0,threats=5000,pruning=0,hash=4,weights=FILE,book=FILE\n"
+              << "  --b SPEC         settings of engine B\n"
+              << "  --games N        games to play, rounded up to pairs (default 100)\n"
+              << "  --threads N      games played at once (default: all cores)\n"
+              << "  --size N         board size, 0 for unbounded (default 15)\n"
+              << "  --win N          stones in a row to win, 3 to 5 (default 5)\n"
+              << "  --openings FILE  openings, one \"x,y x,y ...\" move list per line\n"
+              << "  --opening-plies N  length of the random openings used otherwise (default 3)\n"
+              << "  --max-plies N    adjudicate a draw after N plies\n"
+              << "  --seed N         seed of the openings and of the engines (default 1)\n"
+              << "  --log FILE       CSV log of every game\n"
+              << "  --sprt ELO0,ELO1 stop when the SPRT accepts either hypothesis\n"
+              << "  --alpha P, --beta P  SPRT error rates (default 0.05)\n";
+}
+
+// "key=value,key=value"; unknown keys are errors.
+bool parseEngine(const std::string& spec, engineSettings& engine) {
+    std::stringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        const char* value = item.c_str() + eq + 1;
+        if (key == "depth") {
+            engine.limits.depth = std::atoi(value);
+        } else if (key == "time") {
+            engine.limits.milliseconds = std::atoi(value);
+        } else if (key == "nodes") {
+            engine.limits.nodes = std::strtoull(value, nullptr, 10);
+        } else if (key == "threats") {
+            engine.limits.threatNodes = std::strtoull(value, nullptr, 10);
+        } else if (key == "pruning") {
+            engine.limits.threatPruning = std::atoi(value) != 0;
+        } else if (key == "hash") {
+            engine.hashMb = std::max(1, std::atoi(value));
+        } else if (key == "weights") {
+            std::vector<std::pair<int, int>> weights(WEIGHT_GROUPS);
+            engine.weights = value;
+            if (!readWeights(engine.weights, weights)) {
+                std::cerr << "cannot read weights from " << engine.weights << std::endl;
+                return false;
+            }
+        } else if (key == "book") {
+            std::shared_ptr<OpeningBook> book = std::make_shared<OpeningBook>();
+            if (!book->open(value)) {
+                std::cerr << "cannot open book " << value << std::endl;
+                return false;
+            }
+            engine.book = book;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseOptions(int argc, char** argv, arenaOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--a" || arg == "--b") {
+            if (!parseEngine(value, options.engines[arg == "--b"])) {
+                return false;
+            }
+        } else if (arg == "--games") {
+            options.games = std::max(2, std::atoi(value));
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value));
+        } else if (arg == "--size") {
+            options.boardSize = std::atoi(value);
+            options.boardSize = options.boardSize == 0 ? UNBOUNDED : options.boardSize;
+        } else if (arg == "--win") {
+            options.toWin = std::atoi(value);
+        } else if (arg == "--openings") {
+            options.openings = value;
+        } else if (arg == "--opening-plies") {
+            options.openingPlies = std::max(1, std::atoi(value));
+        } else if (arg == "--max-plies") {
+            options.maxPlies = std::atoi(value);
+        } else if (arg == "--seed") {
+            options.seed = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--log") {
+            options.log = value;
+        } else if (arg == "--sprt") {
+            char comma;
+            std::stringstream bounds(value);
+            if (!(bounds >> options.elo0 >> comma >> options.elo1) || options.elo1 <= options.elo0) {
+                return false;
+            }
+            options.sprt = true;
+        } else if (arg == "--alpha") {
+            options.alpha = std::atof(value);
+        } else if (arg == "--beta") {
+            options.beta = std::atof(value);
+        } else {
+            return false;
+        }
+    }
+    return options.boardSize > 0 && options.toWin >= MIN_WIN && options.toWin <= MAX_WIN;
+}
+
+bool parseMoves(const std::string& text, std::vector<std::pair<int, int>>& moves) {
+    std::stringstream in(text);
+    std::string token;
+    while (in >> token) {
+        int x, y;
+        char comma;
+        std::stringstream coords(token);
+        if (!(coords >> x >> comma >> y)) {
+            return false;
+        }
+        moves.push_back({x, y});
+    }
+    return true;
+}
+
+bool readOpenings(const std::string& path, std::vector<std::vector<std::pair<int, int>>>& openings) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        openings.emplace_back();
+        if (!parseMoves(line, openings.back())) {
+            return false;
+        }
+    }
+    return !openings.empty();
+}
+
+// A stone on the center and the rest at random within two cells of it, clamped
+// to the board so that small boards get full openings too.
+std::vector<std::pair<int, int>> randomOpening(const arenaOptions& options, uint32_t seed) {
+    std::mt19937 rng(seed);
+    int center = options.boardSize / 2;
+    int low = std::max(0, center - 2), span = std::min(options.boardSize - 1, center + 2) - low + 1;
+    std::vector<std::pair<int, int>> moves = {{center, center}};
+    while ((int)moves.size() < std::min(options.openingPlies, span * span)) {
+        std::pair<int, int> m = {low + int(rng() % span), low + int(rng() % span)};
+        if (std::find(moves.begin(), moves.end(), m) == moves.end()) {
+            moves.push_back(m);
+        }
+    }
+    return moves;
+}
+
+// Plays one game on two long-lived engines, which are taken back to the empty
+// board afterwards.
+gameRecord playGame(Game engines[2], const arenaOptions& options, int index, int opening,
+                    const std::vector<std::pair<int, int>>& openingMoves) {
+    gameRecord record;
+    record.index = index;
+    record.opening = opening;
+    record.engineX = index % 2;
+    record.winner = -1;
+    for (int e = 0; e < 2; ++e) {
+        engines[e].getTable().clear();
+        engines[e].setSeed(options.seed + index * 2 + e);
+    }
+    uint64_t cells = uint64_t(options.boardSize) * options.boardSize;
+    uint64_t maxPlies = options.maxPlies > 0 ? std::min<uint64_t>(options.maxPlies, cells) : cells;
+    auto start = std::chrono::steady_clock::now();
+    bool over = false;
+    for (const auto& m : openingMoves) {
+        if (!engines[0].isFree(m.first, m.second)) {
+            break;
+        }
+        for (int e = 0; e < 2; ++e) {
+            engines[e].move(m.first, m.second);
+        }
+        record.moves.push_back(m);
+        record.micros.push_back(0);
+        record.nodes.push_back(0);
+        if (engines[0].checkWin()) {
+            // the opening itself is decided
+            int moverX = !engines[0].isMoveX();
+            record.winner = moverX ? record.engineX : 1 - record.engineX;
+            over = true;
+            break;
+        }
+    }
+    while (!over && record.moves.size() < maxPlies) {
+        int side = engines[0].isMoveX() ? record.engineX : 1 - record.engineX;
+        auto moveStart = std::chrono::steady_clock::now();
+        searchResult result = engines[side].think(options.engines[side].limits);
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - moveStart).count();
+        if (result.move.first < 0) {
+            break; // the board is full: a draw
+        }
+        if (!engines[0].isFree(result.move.first, result.move.second)) {
+            record.winner = 1 - side; // illegal move
+            break;
+        }
+        for (int e = 0; e < 2; ++e) {
+            engines[e].move(result.move.first, result.move.second);
+        }
+        record.moves.push_back(result.move);
+        record.micros.push_back(micros);
+        record.nodes.push_back(result.nodes);
+        if (engines[0].checkWin()) {
+            record.winner = side;
+            over = true;
+        }
+    }
+    record.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (int e = 0; e < 2; ++e) {
+        while (engines[e].undo()) {}
+    }
+    return record;
+}
+
+const char* outcome(const gameRecord& record) {
+    if (record.winner == -1) {
+        return "1/2-1/2";
+    }
+    return (record.winner == record.engineX) ? "1-0" : "0-1";
+}
+
+void writeCsvHeader(std::ostream& out) {
+    out << "game,opening,x,result,plies,seconds,moves,micros,nodes\n";
+}
+
+// Moves in the PGN-like "x,y x,y ..." form, per-move times and nodes likewise.
+void writeCsv(std::ostream& out, const gameRecord& record) {
+    out << record.index << "," << record.opening << "," << (record.engineX == 0 ? "A" : "B") << ","
+        << outcome(record) << "," << record.moves.size() << "," << record.seconds << ",\"";
+    for (size_t i = 0; i < record.moves.size(); ++i) {
+        out << (i ? " " : "") << record.moves[i].first << "," << record.moves[i].second;
+    }
+    out << "\",\"";
+    for (size_t i = 0; i < record.micros.size(); ++i) {
+        out << (i ? " " : "") << record.micros[i];
+    }
+    out << "\",\"";
+    for (size_t i = 0; i < record.nodes.size(); ++i) {
+        out << (i ? " " : "") << record.nodes[i];
+    }
+    out << "\"\n";
+}
+
+// Results from A's point of view.
+struct tally {
+    int wins = 0, draws = 0, losses = 0;
+
+    int games() const {
+        return wins + draws + losses;
+    }
+
+    double score() const {
+        return games() ? (wins + 0.5 * draws) / games() : 0.5;
+    }
+
+    // Variance of a single game's score.
+    double variance() const {
+        double s = score();
+        return games() ? (wins * (1 - s) * (1 - s) + draws * (0.5 - s) * (0.5 - s) + losses * s * s) / games() : 0;
+    }
+};
+
+double eloFromScore(double s) {
+    if (s <= 0 || s >= 1) {
+        return s <= 0 ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+    }
+    return 400 * std::log10(s / (1 - s));
+}
+
+double scoreFromElo(double elo) {
+    return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+// Log-likelihood ratio of elo1 against elo0, normal approximation of the
+// trinomial model.
+double sprtLlr(const tally& t, double elo0, double elo1) {
+    double variance = t.variance();
+    if (t.games() == 0 || variance <= 0) {
+        return 0;
+    }
+    double s0 = scoreFromElo(elo0), s1 = scoreFromElo(elo1);
+    return t.games() * (s1 - s0) * (2 * t.score() - s0 - s1) / (2 * variance);
+}
+
+void report(std::ostream& out, const tally& t, const arenaOptions& options, double seconds, bool final) {
+    double margin = 1.96 * std::sqrt(t.variance() / std::max(1, t.games()));
+    double s = t.score();
+    out << "games " << t.games() << ": +" << t.wins << " =" << t.draws << " -" << t.losses
+        << " score " << s << " elo " << eloFromScore(s)
+        << " [" << eloFromScore(s - margin) << ", " << eloFromScore(s + margin) << "]";
+    if (t.wins + t.losses > 0) {
+        out << " los " << 0.5 * (1 + std::erf((t.wins - t.losses) / std::sqrt(2.0 * (t.wins + t.losses))));
+    }
+    if (options.sprt) {
+        out << " llr " << sprtLlr(t, options.elo0, options.elo1)
+            << " (" << std::log(options.beta / (1 - options.alpha)) << ", "
+            << std::log((1 - options.beta) / options.alpha) << ")";
+    }
+    double perMinute = seconds > 0 ? 60 * t.games() / seconds : 0;
+    int cores = std::min<int>(options.threads, std::max(1u, std::thread::hardware_concurrency()));
+    out << " games/min " << perMinute << " per core " << perMinute / cores << std::endl;
+    if (final && options.sprt) {
+        double llr = sprtLlr(t, options.elo0, options.elo1);
+        out << "sprt: " << (llr >= std::log((1 - options.beta) / options.alpha) ? "H1 accepted"
+                           : llr <= std::log(options.beta / (1 - options.alpha)) ? "H0 accepted"
+                           : "inconclusive") << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    arenaOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::vector<std::vector<std::pair<int, int>>> openings;
+    if (!options.openings.empty() && !readOpenings(options.openings, openings)) {
+        std::cerr << "cannot read openings from " << options.openings << std::endl;
+        return 1;
+    }
+    int pairs = (options.games + 1) / 2;
+    std::ofstream log;
+    if (!options.log.empty()) {
+        log.open(options.log);
+        writeCsvHeader(log);
+    }
+
+    std::mutex mutex;
+    tally results;
+    std::atomic<int> next{0};
+    std::atomic<bool> stop{false};
+    double sprtLower = std::log(options.beta / (1 - options.alpha));
+    double sprtUpper = std::log((1 - options.beta) / options.alpha);
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto worker = [&]() {
+        Game engines[2] = {Game(options.boardSize, options.toWin), Game(options.boardSize, options.toWin)};
+        for (int e = 0; e < 2; ++e) {
+            engines[e].setHashSize(options.engines[e].hashMb);
+            if (!options.engines[e].weights.empty()) {
+                engines[e].loadWeights(options.engines[e].weights);
+            }
+            engines[e].setBook(options.engines[e].book);
+        }
+        for (int index = next++; index < 2 * pairs && !stop; index = next++) {
+            int opening = index / 2;
+            std::vector<std::pair<int, int>> moves = openings.empty()
+                ? randomOpening(options, options.seed * 7919 + opening)
+                : openings[opening % openings.size()];
+            gameRecord record = playGame(engines, options, index, opening, moves);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (record.winner == -1) {
+                ++results.draws;
+            } else if (record.winner == 0) {
+                ++results.wins;
+            } else {
+                ++results.losses;
+            }
+            if (log) {
+                writeCsv(log, record);
+                log.flush();
+            }
+            if (results.games() % 20 == 0) {
+                report(std::cerr, results, options, elapsed(), false);
+            }
+            double llr = sprtLlr(results, options.elo0, options.elo1);
+            if (options.sprt && (llr >= sprtUpper || llr <= sprtLower)) {
+                stop = true;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < options.threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    report(std::cout, results, options, elapsed(), true);
+    return 0;
+}
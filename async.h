@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "ttt.h"
+
+// Runs Game::think on a worker thread over a private copy of the position, so the
+// caller keeps using its own Game meanwhile. The latest completed iteration can be
+// read at any time; the final result is collected with poll().
+class AsyncSearch {
+public:
+    AsyncSearch() = default;
+    AsyncSearch(const AsyncSearch&) = delete;
+    AsyncSearch& operator=(const AsyncSearch&) = delete;
+
+    ~AsyncSearch() {
+        cancel();
+    }
+
+    // Cancels any search in progress and starts a new one; limits.cancel and
+    // limits.progress are replaced.
+    void start(Game position, searchLimits limits) {
+        cancel();
+        stop = false;
+        done = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = searchResult();
+        }
+        limits.cancel = &stop;
+        limits.progress = [this](const searchResult& r) {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = r;
+        };
+        worker = std::thread([this, position = std::move(position), limits = std::move(limits)]() mutable {
+            searchResult r = position.think(limits);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                latest = r;
+            }
+            done = true;
+        });
+    }
+
+    // Stops the search and waits for the worker; its result is dropped.
+    void cancel() {
+        stop = true;
+        if (worker.joinable()) {
+            worker.join();
+        }
+        done = false;
+    }
+
+    bool busy() const {
+        return worker.joinable() && !done;
+    }
+
+    // True once the search has finished, with its result; the search is then idle.
+    bool poll(searchResult& result) {
+        if (!worker.joinable() || !done) {
+            return false;
+        }
+        worker.join();
+        done = false;
+        std::lock_guard<std::mutex> lock(mutex);
+        result = latest;
+        return true;
+    }
+
+    // Best move, score and depth of the last completed iteration.
+    searchResult progress() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return latest;
+    }
+
+private:
+    std::thread worker;
+    std::atomic<bool> stop{false}, done{false};
+    std::mutex mutex;
+    searchResult latest;
+};
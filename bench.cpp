@@ -0,0 +1,386 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+
+#include "ttt.h"
+
+// Search benchmark over a fixed corpus of positions, plus microbenchmarks of the
+// evaluation hot paths. Results are written as JSON (stdout or --out), a summary
+// goes to stderr:
+//     g++ -O2 bench.cpp -o bench -pthread && ./bench --depth 5 --out bench.json
+// With the default single thread and fixed seed the node counts are reproducible,
+// so two commits can be compared position by position. Nodes, seconds and nps
+// are the alpha-beta search's; the threat solver run before it is reported on
+// its own, and moveSeconds times the whole move.
+//
+// --check-alloc instead searches every position twice on the same Game and
+// counts heap allocations during the second search, which must stay within a
+// small per-search budget however many nodes it visits.
+
+// GCC pairs the malloc of the replaced operator new with the free of the replaced
+// operator delete where both are inlined, and reports a mismatch that is not one.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+// Every operator new of the process, for --check-alloc.
+std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Allocations allowed per search: results, principal variations and progress
+// reports of each iteration, never per node.
+const uint64_t ALLOC_BUDGET = 64;
+
+struct benchPosition {
+    const char* name;
+    const char* kind;  // opening, midgame or puzzle
+    int boardSize;
+    const char* moves; // "x,y x,y ...", X first
+    const char* best;  // known best move or nullptr
+};
+
+// Midgames and puzzles come from engine self-play; every puzzle is a forced win
+// for the side to move, `best` being the first move of one winning line.
+const benchPosition CORPUS[] = {
+    {"open-1", "opening", 15, "7,7", nullptr},
+    {"open-2", "opening", 15, "7,7 7,8", nullptr},
+    {"open-3", "opening", 15, "7,7 8,8 7,9", nullptr},
+    {"open-4", "opening", 15, "7,7 6,8 8,8 6,6", nullptr},
+    {"open-edge", "opening", 15, "0,0 1,1 0,2", nullptr},
+    {"mid-1", "midgame", 15, "7,7 6,7 5,9 6,8 6,6 5,8 7,6 8,8 4,8 7,8 9,8 8,7 8,9 6,10 9,6", nullptr},
+    {"mid-2", "midgame", 15, "7,7 6,7 5,9 6,8 6,6 5,8 7,6 8,8 4,8 7,8 9,8 8,7 8,9 6,10 9,6 6,9 6,11 5,10 4,11", nullptr},
+    {"mid-3", "midgame", 15, "7,7 7,5 8,8 6,5 8,7 6,6 5,7 9,7 6,7 4,7 8,6 8,5 8,9 8,10 9,5", nullptr},
+    {"mid-4", "midgame", 15, "7,7 7,5 8,8 6,5 8,7 6,6 5,7 9,7 6,7 4,7 8,6 8,5 8,9 8,10 9,5 6,8 11,3 10,4 5,6 4,5 5,5", nullptr},
+    {"mid-5", "midgame", 15, "7,7 5,8 8,9 4,6 7,8 7,6 6,7 5,6 6,6 6,5 8,8", nullptr},
+    {"mid-6", "midgame", 15, "7,7 7,8 8,8 6,6 8,7 6,7 6,5 7,6 5,6 8,4 5,8 7,4 8,6", nullptr},
+    {"mid-7", "midgame", 15, "7,7 5,6 8,5 6,8 7,6 7,8 6,7 5,8 8,8 4,8 3,8 5,7 5,5 5,10 5,9", nullptr},
+    {"mid-unbounded", "midgame", UNBOUNDED, "16384,16384 16383,16384 16382,16386 16383,16385 16383,16383 16382,16385 16384,16383 16385,16385 16381,16385 16384,16385 16386,16385 16385,16384 16385,16386 16383,16387 16386,16383", nullptr},
+    {"mid-large", "midgame", 100, "50,50 49,50 48,52 49,51 49,49 48,51 50,49 51,51 47,51 50,51 52,51 51,50 51,52 49,53 52,49", nullptr},
+    {"vcf-7", "puzzle", 15, "7,7 6,7 6,8 8,5 7,8 8,6 8,8 5,8 10,8 9,8 7,6 7,5", "7,9"},
+    {"vcf-5a", "puzzle", 15, "7,7 6,7 6,8 8,5 7,8 8,6 8,8 5,8 10,8 9,8 7,6 7,5 7,9 7,10", "8,10"},
+    {"vcf-5b", "puzzle", 15, "7,7 9,5 7,8 6,6 6,7 5,7 7,5 7,6 8,6 5,6 8,7 4,6 3,6 6,4", "8,8"},
+    {"vcf-7b", "puzzle", 15, "7,7 5,6 8,5 6,8 7,6 7,8 6,7 5,8 8,8 4,8 3,8 5,7 5,5 5,10 5,9 6,6 7,5 3,9 2,10 6,5", "7,4"},
+    {"vcf-5c", "puzzle", 15, "7,7 5,6 8,5 6,8 7,6 7,8 6,7 5,8 8,8 4,8 3,8 5,7 5,5 5,10 5,9 6,6 7,5 3,9 2,10 6,5 7,4 7,3", "8,7"},
+};
+
+struct benchOptions {
+    int depth = 5;
+    int milliseconds = 0;
+    int threads = 1;
+    uint32_t seed = 1;
+    double microSeconds = 0.2; // minimum run time of each microbenchmark
+    bool micro = true;
+    bool checkAlloc = false;
+    std::string out;
+};
+
+struct depthStat {
+    int depth;
+    double seconds;
+    uint64_t nodes;
+};
+
+struct positionStat {
+    const benchPosition* position;
+    searchResult result;
+    double moveSeconds = 0; // the whole move: book, threat solver and search
+    std::vector<depthStat> depths;
+    double hitRate = 0;
+    double branching = 0;
+    bool bestMatch = false, solved = false;
+};
+
+struct microStat {
+    const char* name;
+    uint64_t ops;
+    double seconds;
+};
+
+// Reaches into Game for the microbenchmarks; a friend of Game.
+class Bench {
+public:
+    static bool setUp(Game& game, const benchPosition& position) {
+        std::stringstream in(position.moves);
+        std::string token;
+        while (in >> token) {
+            int x, y;
+            char comma;
+            std::stringstream coords(token);
+            if (!(coords >> x >> comma >> y) || !game.isFree(x, y)) {
+                return false;
+            }
+            game.move(x, y);
+        }
+        return true;
+    }
+
+    // Every line a move evaluation reads, over the cells of the materialized
+    // window; the rest of an unbounded board is empty and never read.
+    static uint64_t processText(Game& game, uint64_t& sink) {
+        uint64_t ops = 0;
+        const Board& board = game.board;
+        for (int x = board.firstX(); x < board.firstX() + board.size(); ++x) {
+            for (int y = board.firstY(); y < board.firstY() + board.size(); ++y) {
+                for (int d = 0; d < DIRECTIONS; ++d) {
+                    hits h;
+                    game.automatum->processText(game.board.line(x, y, d, -game.toWin, game.toWin), h);
+                    sink += h.once ^ h.more;
+                    ++ops;
+                }
+            }
+        }
+        return ops;
+    }
+
+    static uint64_t evaluateMove(Game& game, uint64_t& sink) {
+        std::vector<moveWithEval> moves;
+        game.getAvailableMoves(moves);
+        for (const auto& m : moves) {
+            sink += game.evaluateMove(m.move.first, m.move.second);
+        }
+        return moves.size();
+    }
+
+    static uint64_t evaluatePosition(Game& game, uint64_t& sink) {
+        sink += game.evaluatePosition();
+        return 1;
+    }
+
+    static uint64_t getAvailableMoves(Game& game, uint64_t& sink) {
+        std::vector<moveWithEval>& moves = game.moveBuffer(0);
+        game.getAvailableMoves(moves);
+        sink += moves.size();
+        return 1;
+    }
+};
+
+std::string moveString(std::pair<int, int> m) {
+    return std::to_string(m.first) + "," + std::to_string(m.second);
+}
+
+positionStat runPosition(const benchPosition& position, const benchOptions& options) {
+    positionStat stat;
+    stat.position = &position;
+    Game game(position.boardSize, 5);
+    game.setSeed(options.seed);
+    if (!Bench::setUp(game, position)) {
+        std::cerr << "bad corpus position " << position.name << std::endl;
+        exit(1);
+    }
+    searchLimits limits;
+    limits.depth = options.depth;
+    limits.milliseconds = options.milliseconds;
+    limits.threads = options.threads;
+    limits.progress = [&stat](const searchResult& r) {
+        stat.depths.push_back({r.depth, r.seconds, r.nodes});
+    };
+    auto start = std::chrono::steady_clock::now();
+    stat.result = game.think(limits);
+    stat.moveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    TranspositionTable& table = game.getTable();
+    uint64_t probes = table.hits() + table.misses() + table.collisions();
+    stat.hitRate = probes > 0 ? double(table.hits()) / probes : 0;
+    // effective branching factor between the first and last completed iterations
+    if (stat.depths.size() >= 2) {
+        const depthStat& first = stat.depths.front();
+        const depthStat& last = stat.depths.back();
+        if (first.nodes > 0 && last.depth > first.depth) {
+            stat.branching = std::pow(double(last.nodes) / first.nodes, 1.0 / (last.depth - first.depth));
+        }
+    }
+    stat.bestMatch = position.best != nullptr && moveString(stat.result.move) == position.best;
+    int win = game.isMoveX() ? 100000 : -100000;
+    stat.solved = stat.result.score == win;
+    return stat;
+}
+
+// Allocations of a repeated search of the position; false if over budget.
+bool checkAllocations(const benchPosition& position, const benchOptions& options) {
+    Game game(position.boardSize, 5);
+    game.setSeed(options.seed);
+    Bench::setUp(game, position);
+    searchLimits limits;
+    limits.depth = options.depth;
+    limits.milliseconds = options.milliseconds;
+    game.think(limits); // sizes the buffers and the undo stack
+    game.getTable().clear();
+    uint64_t before = allocations;
+    searchResult result = game.think(limits);
+    uint64_t count = allocations - before;
+    std::cerr << position.name << ": " << count << " allocations, " << result.nodes << " nodes" << std::endl;
+    return count <= ALLOC_BUDGET;
+}
+
+microStat runMicro(const char* name, uint64_t (*body)(Game&, uint64_t&), const benchOptions& options, uint64_t& sink) {
+    std::vector<Game> games;
+    for (const auto& position : CORPUS) {
+        if (std::string(position.kind) == "midgame") {
+            games.emplace_back(position.boardSize, 5);
+            games.back().setSeed(options.seed);
+            Bench::setUp(games.back(), position);
+        }
+    }
+    microStat stat = {name, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    do {
+        for (auto& game : games) {
+            stat.ops += body(game, sink);
+        }
+        stat.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (stat.seconds < options.microSeconds);
+    return stat;
+}
+
+void writeJson(std::ostream& out, const benchOptions& options, const std::vector<positionStat>& positions,
+               const std::vector<microStat>& micros) {
+    uint64_t nodes = 0, threatNodes = 0;
+    double seconds = 0, threatSeconds = 0, moveSeconds = 0;
+    int known = 0, matched = 0, puzzles = 0, solved = 0;
+    for (const auto& p : positions) {
+        nodes += p.result.nodes;
+        seconds += p.result.seconds;
+        threatNodes += p.result.threatNodes;
+        threatSeconds += p.result.threatSeconds;
+        moveSeconds += p.moveSeconds;
+        known += p.position->best != nullptr;
+        matched += p.bestMatch;
+        bool puzzle = std::string(p.position->kind) == "puzzle";
+        puzzles += puzzle;
+        solved += puzzle && p.solved;
+    }
+    out << "{\n";
+    out << "  \"config\": {\"depth\": " << options.depth << ", \"milliseconds\": " << options.milliseconds
+        << ", \"threads\": " << options.threads << ", \"seed\": " << options.seed << "},\n";
+    out << "  \"summary\": {\"nodes\": " << nodes << ", \"seconds\": " << seconds
+        << ", \"nps\": " << (seconds > 0 ? nodes / seconds : 0)
+        << ", \"threatNodes\": " << threatNodes << ", \"threatSeconds\": " << threatSeconds
+        << ", \"moveSeconds\": " << moveSeconds
+        << ", \"bestMatch\": " << matched << ", \"bestKnown\": " << known
+        << ", \"puzzlesSolved\": " << solved << ", \"puzzles\": " << puzzles << "},\n";
+    out << "  \"positions\": [\n";
+    for (size_t i = 0; i < positions.size(); ++i) {
+        const positionStat& p = positions[i];
+        const searchResult& r = p.result;
+        out << "    {\"name\": \"" << p.position->name << "\", \"kind\": \"" << p.position->kind << "\""
+            << ", \"move\": \"" << moveString(r.move) << "\", \"score\": " << r.score
+            << ", \"depth\": " << r.depth << ", \"nodes\": " << r.nodes << ", \"seconds\": " << r.seconds
+            << ", \"nps\": " << (r.seconds > 0 ? r.nodes / r.seconds : 0)
+            << ", \"threatNodes\": " << r.threatNodes << ", \"threatSeconds\": " << r.threatSeconds
+            << ", \"moveSeconds\": " << p.moveSeconds
+            << ", \"ttHitRate\": " << p.hitRate << ", \"branching\": " << p.branching;
+        if (p.position->best != nullptr) {
+            out << ", \"best\": \"" << p.position->best << "\", \"bestMatch\": " << (p.bestMatch ? "true" : "false");
+        }
+        out << ", \"solved\": " << (p.solved ? "true" : "false") << ",\n      \"timeToDepth\": [";
+        for (size_t j = 0; j < p.depths.size(); ++j) {
+            out << (j ? ", " : "") << "{\"depth\": " << p.depths[j].depth << ", \"seconds\": " << p.depths[j].seconds
+                << ", \"nodes\": " << p.depths[j].nodes << "}";
+        }
+        out << "]}" << (i + 1 < positions.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"micro\": [\n";
+    for (size_t i = 0; i < micros.size(); ++i) {
+        const microStat& m = micros[i];
+        out << "    {\"name\": \"" << m.name << "\", \"ops\": " << m.ops << ", \"seconds\": " << m.seconds
+            << ", \"nsPerOp\": " << (m.ops > 0 ? m.seconds * 1e9 / m.ops : 0) << "}"
+            << (i + 1 < micros.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+bool parseOptions(int argc, char** argv, benchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-micro") {
+            options.micro = false;
+            continue;
+        }
+        if (arg == "--check-alloc") {
+            options.checkAlloc = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--depth") {
+            options.depth = std::atoi(value);
+        } else if (arg == "--time") {
+            options.milliseconds = std::atoi(value);
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value));
+        } else if (arg == "--seed") {
+            options.seed = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--micro-time") {
+            options.microSeconds = std::atof(value);
+        } else if (arg == "--out") {
+            options.out = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    benchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: " << argv[0] << " [--depth N] [--time MS] [--threads N] [--seed N]"
+                  << " [--micro-time S] [--no-micro] [--check-alloc] [--out FILE]" << std::endl;
+        return 2;
+    }
+    if (options.checkAlloc) {
+        bool ok = true;
+        for (const auto& position : CORPUS) {
+            ok &= checkAllocations(position, options);
+        }
+        std::cerr << (ok ? "allocations within budget" : "allocations over budget") << std::endl;
+        return ok ? 0 : 1;
+    }
+    std::vector<positionStat> positions;
+    for (const auto& position : CORPUS) {
+        positions.push_back(runPosition(position, options));
+        const positionStat& p = positions.back();
+        std::cerr << p.position->name << ": " << moveString(p.result.move) << " score " << p.result.score
+                  << " depth " << p.result.depth << " nodes " << p.result.nodes
+                  << " threat nodes " << p.result.threatNodes << " time " << p.moveSeconds << "s" << std::endl;
+    }
+    std::vector<microStat> micros;
+    if (options.micro) {
+        uint64_t sink = 0;
+        micros.push_back(runMicro("processText", Bench::processText, options, sink));
+        micros.push_back(runMicro("evaluateMove", Bench::evaluateMove, options, sink));
+        micros.push_back(runMicro("evaluatePosition", Bench::evaluatePosition, options, sink));
+        micros.push_back(runMicro("getAvailableMoves", Bench::getAvailableMoves, options, sink));
+        for (const auto& m : micros) {
+            std::cerr << m.name << ": " << m.seconds * 1e9 / m.ops << " ns/op" << std::endl;
+        }
+        std::cerr << "(checksum " << sink << ")" << std::endl;
+    }
+    if (options.out.empty()) {
+        writeJson(std::cout, options, positions, micros);
+    } else {
+        std::ofstream file(options.out);
+        writeJson(file, options, positions, micros);
+    }
+    return 0;
+}
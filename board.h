@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+enum Cell : uint8_t {
+    EMPTY = 0,
+    CROSS = 1,
+    NOUGHT = 2,
+    WALL = 3 // padding around the playable area
+};
+
+// Directions of the four lines through a cell: ↓, →, ↘, ↙ in (x, y) board coordinates.
+const int DIRECTIONS = 4;
+const int DIR_X[DIRECTIONS] = {1, 0, 1, 1};
+const int DIR_Y[DIRECTIONS] = {0, 1, 1, -1};
+
+// Contiguous run of cells along one direction, already clipped to the playable area.
+struct LineView {
+    const uint8_t* first;
+    std::ptrdiff_t step;
+    int length;
+
+    uint8_t operator[](int i) const {
+        return first[i * step];
+    }
+};
+
+// Flat board: one byte per cell surrounded by `padding` rows/columns of WALL cells,
+// so neighbourhood reads up to `padding` cells away from any playable cell need no
+// bounds checks. X and O stones are additionally mirrored into bit planes
+// (row x + padding, bit y + padding, relative to the first cell) for whole-row
+// bitwise scans. The playable area is the size x size square starting at
+// (firstX, firstY), which lets a board cover just a window of a larger game.
+class Board {
+public:
+    Board() = default;
+    Board(int size, int padding, int firstX = 0, int firstY = 0):
+        boardSize(size), padding(padding), originX(firstX), originY(firstY) {
+        rowStride = boardSize + 2 * padding;
+        words = (rowStride + 63) / 64;
+        cells.assign(rowStride * rowStride, WALL);
+        for (int x = 0; x < boardSize; ++x) {
+            std::fill_n(cells.begin() + index(originX + x, originY), boardSize, EMPTY);
+        }
+        bits.assign(2 * rowStride * words, 0);
+        for (int d = 0; d < DIRECTIONS; ++d) {
+            offsets[d] = DIR_X[d] * rowStride + DIR_Y[d];
+        }
+    }
+
+    int size() const {
+        return boardSize;
+    }
+
+    int getPadding() const {
+        return padding;
+    }
+
+    // Coordinates of the first playable cell.
+    int firstX() const {
+        return originX;
+    }
+
+    int firstY() const {
+        return originY;
+    }
+
+    int stride() const {
+        return rowStride;
+    }
+
+    // Offset between neighbouring cells along direction d.
+    int offset(int d) const {
+        return offsets[d];
+    }
+
+    bool inside(int x, int y) const {
+        return x >= originX && x < originX + boardSize && y >= originY && y < originY + boardSize;
+    }
+
+    int index(int x, int y) const {
+        return (x - originX + padding) * rowStride + (y - originY + padding);
+    }
+
+    void coords(int idx, int& x, int& y) const {
+        x = idx / rowStride - padding + originX;
+        y = idx % rowStride - padding + originY;
+    }
+
+    uint8_t at(int x, int y) const {
+        return cells[index(x, y)];
+    }
+
+    uint8_t operator[](int idx) const {
+        return cells[idx];
+    }
+
+    const uint8_t* data() const {
+        return cells.data();
+    }
+
+    void set(int x, int y, uint8_t value) {
+        int idx = index(x, y);
+        uint8_t old = cells[idx];
+        if (old == CROSS || old == NOUGHT) {
+            flipBit(old, x, y);
+        }
+        cells[idx] = value;
+        if (value == CROSS || value == NOUGHT) {
+            flipBit(value, x, y);
+        }
+    }
+
+    // Words per padded row in a bit plane.
+    int planeWords() const {
+        return words;
+    }
+
+    // Bit plane of the given player (CROSS or NOUGHT), rowStride rows of planeWords() words.
+    const uint64_t* plane(uint8_t player) const {
+        return bits.data() + (player - 1) * rowStride * words;
+    }
+
+    // Cells (x + k * dx, y + k * dy) for k in [from, to] that lie on the board.
+    LineView line(int x, int y, int d, int from, int to) const {
+        clip(x - originX, DIR_X[d], from, to);
+        clip(y - originY, DIR_Y[d], from, to);
+        if (from > to) {
+            return {cells.data(), offsets[d], 0};
+        }
+        return {cells.data() + index(x + from * DIR_X[d], y + from * DIR_Y[d]), offsets[d], to - from + 1};
+    }
+
+private:
+    int boardSize = 0, padding = 0;
+    int originX = 0, originY = 0;
+    int rowStride = 0, words = 0;
+    int offsets[DIRECTIONS] = {0, 0, 0, 0};
+    std::vector<uint8_t> cells;
+    std::vector<uint64_t> bits;
+
+    void flipBit(uint8_t player, int x, int y) {
+        int col = y - originY + padding;
+        bits[((player - 1) * rowStride + x - originX + padding) * words + col / 64] ^= uint64_t(1) << (col % 64);
+    }
+
+    // Narrows [from, to] so that c + k * dc stays within [0, boardSize).
+    void clip(int c, int dc, int& from, int& to) const {
+        if (dc == 0) {
+            if (c < 0 || c >= boardSize) {
+                to = from - 1;
+            }
+        } else if (dc > 0) {
+            from = std::max(from, -c);
+            to = std::min(to, boardSize - 1 - c);
+        } else {
+            from = std::max(from, c - (boardSize - 1));
+            to = std::min(to, c);
+        }
+    }
+};
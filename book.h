@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tt.h"
+
+// Opening book: best moves of early positions, searched offline (bookgen.cpp).
+//
+// Positions are keyed independently of where they are on the board and of how they
+// are turned: the stones are mapped by each of the 8 symmetries of the square and
+// shifted so that their bounding box starts at (0, 0), and the smallest Zobrist key
+// of the eight is the position's key. Moves are stored in that canonical frame.
+//
+// The file is a header followed by entries sorted by key, used in place through
+// mmap, so opening a book reads nothing but the header.
+
+const char BOOK_MAGIC[8] = {'T', 'T', 'T', 'B', 'O', 'O', 'K', '1'};
+
+// Loaded at startup by the front ends when present in the working directory.
+const char* const DEFAULT_BOOK_FILE = "book.bin";
+
+struct bookHeader {
+    char magic[8];
+    uint32_t toWin;
+    uint32_t maxStones; // positions with more stones are not in the book
+    uint64_t count;     // entries
+    uint64_t reserved;
+};
+
+struct bookEntry {
+    uint64_t key;
+    int32_t score;   // from X's point of view, as in searchResult
+    int8_t x, y;     // move in the canonical frame
+    uint8_t depth;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(bookHeader) == 32 && sizeof(bookEntry) == 16, "book layout is part of the file format");
+
+struct bookStone {
+    int x, y;
+    uint8_t player;
+};
+
+// Symmetry s swaps the axes if bit 0 is set, then negates x on bit 1 and y on bit 2.
+inline void applySymmetry(int s, int x, int y, int& tx, int& ty) {
+    tx = (s & 1) ? y : x;
+    ty = (s & 1) ? x : y;
+    tx = (s & 2) ? -tx : tx;
+    ty = (s & 4) ? -ty : ty;
+}
+
+// Maps board coordinates to the canonical frame of a position and back.
+struct bookFrame {
+    int symmetry = 0;
+    int offsetX = 0, offsetY = 0;
+
+    void toBook(int x, int y, int& bx, int& by) const {
+        applySymmetry(symmetry, x, y, bx, by);
+        bx -= offsetX;
+        by -= offsetY;
+    }
+
+    void fromBook(int bx, int by, int& x, int& y) const {
+        int tx = bx + offsetX, ty = by + offsetY;
+        tx = (symmetry & 2) ? -tx : tx;
+        ty = (symmetry & 4) ? -ty : ty;
+        x = (symmetry & 1) ? ty : tx;
+        y = (symmetry & 1) ? tx : ty;
+    }
+};
+
+// Canonical key of the stones with the given side to move, and its frame.
+inline uint64_t bookKey(const std::vector<bookStone>& stones, bool moveX, bookFrame& frame) {
+    uint64_t best = 0;
+    for (int s = 0; s < 8; ++s) {
+        int minX = INT32_MAX, minY = INT32_MAX, tx, ty;
+        for (const auto& stone : stones) {
+            applySymmetry(s, stone.x, stone.y, tx, ty);
+            minX = std::min(minX, tx);
+            minY = std::min(minY, ty);
+        }
+        uint64_t key = moveX ? 0 : SIDE_KEY;
+        for (const auto& stone : stones) {
+            applySymmetry(s, stone.x, stone.y, tx, ty);
+            key ^= zobristKey(tx - minX, ty - minY, stone.player);
+        }
+        if (s == 0 || key < best) {
+            best = key;
+            frame = {s, minX, minY};
+        }
+    }
+    return best;
+}
+
+class OpeningBook {
+public:
+    OpeningBook() = default;
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    ~OpeningBook() {
+        if (map != nullptr) {
+            munmap(map, length);
+        }
+    }
+
+    // Maps the file; false if it is missing or not a book.
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(bookHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        const bookHeader* h = static_cast<const bookHeader*>(p);
+        if (std::memcmp(h->magic, BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0
+            || st.st_size != (off_t)(sizeof(bookHeader) + h->count * sizeof(bookEntry))) {
+            munmap(p, st.st_size);
+            return false;
+        }
+        map = p;
+        length = st.st_size;
+        header = h;
+        entries = reinterpret_cast<const bookEntry*>(h + 1);
+        return true;
+    }
+
+    int toWin() const {
+        return header ? header->toWin : 0;
+    }
+
+    int maxStones() const {
+        return header ? header->maxStones : 0;
+    }
+
+    size_t size() const {
+        return header ? header->count : 0;
+    }
+
+    // First entry with the key, nullptr if there is none.
+    const bookEntry* find(uint64_t key) const {
+        const bookEntry* end = entries + size();
+        const bookEntry* e = std::lower_bound(entries, end, key, [](const bookEntry& a, uint64_t k) {
+            return a.key < k;
+        });
+        return e != end && e->key == key ? e : nullptr;
+    }
+
+private:
+    void* map = nullptr;
+    size_t length = 0;
+    const bookHeader* header = nullptr;
+    const bookEntry* entries = nullptr;
+};
+
+inline bool writeBook(const std::string& path, int toWin, int maxStones, std::vector<bookEntry> entries) {
+    std::stable_sort(entries.begin(), entries.end(), [](const bookEntry& a, const bookEntry& b) {
+        return a.key < b.key;
+    });
+    bookHeader header = {};
+    std::memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+    header.toWin = toWin;
+    header.maxStones = maxStones;
+    header.count = entries.size();
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(bookEntry));
+    return bool(file);
+}
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_set>
+
+#include "ttt.h"
+
+// Builds an opening book from deep searches. Starting from a stone in the center,
+// every position reachable by moves next to the stones is searched, up to the
+// given number of stones; positions equal under symmetry or translation are
+// searched once. Levels are searched in parallel, one position per thread:
+//     g++ -O2 bookgen.cpp -o bookgen -pthread
+//     ./bookgen --plies 4 --depth 6 --out book.bin
+
+struct bookgenOptions {
+    int toWin = 5;
+    int plies = 4;      // most stones in a book position
+    int radius = 1;     // distance of the expanded moves from the stones
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t hashMb = 64;
+    std::string out = DEFAULT_BOOK_FILE;
+    std::string weights;
+    searchLimits limits;
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --plies N     most stones in a book position (default 4)\n"
+              << "  --radius N    expand moves up to N cells from the stones (default 1)\n"
+              << "  --depth N     search depth per position (default 6)\n"
+              << "  --time MS     time per position, 0 for none\n"
+              << "  --win N       stones in a row to win, 3 to 5 (default 5)\n"
+              << "  --threads N   positions searched at once (default: all cores)\n"
+              << "  --hash MB     transposition table per thread (default 64)\n"
+              << "  --weights FILE evaluation weights\n"
+              << "  --out FILE    book file (default " << DEFAULT_BOOK_FILE << ")\n";
+}
+
+bool parseOptions(int argc, char** argv, bookgenOptions& options) {
+    options.limits.depth = 6;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--plies") {
+            options.plies = std::max(1, std::atoi(value));
+        } else if (arg == "--radius") {
+            options.radius = std::max(1, std::atoi(value));
+        } else if (arg == "--depth") {
+            options.limits.depth = std::atoi(value);
+        } else if (arg == "--time") {
+            options.limits.milliseconds = std::atoi(value);
+        } else if (arg == "--win") {
+            options.toWin = std::atoi(value);
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value));
+        } else if (arg == "--hash") {
+            options.hashMb = std::max(1, std::atoi(value));
+        } else if (arg == "--weights") {
+            options.weights = value;
+        } else if (arg == "--out") {
+            options.out = value;
+        } else {
+            return false;
+        }
+    }
+    return options.toWin >= MIN_WIN && options.toWin <= MAX_WIN && options.plies < 64;
+}
+
+typedef std::vector<std::pair<int, int>> line;
+
+std::vector<bookStone> stonesOf(const line& moves) {
+    std::vector<bookStone> stones;
+    for (size_t i = 0; i < moves.size(); ++i) {
+        stones.push_back({moves[i].first, moves[i].second, i % 2 == 0 ? CROSS : NOUGHT});
+    }
+    return stones;
+}
+
+int main(int argc, char** argv) {
+    bookgenOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    // an unbounded board, so that no position is near an edge
+    int center = UNBOUNDED / 2;
+    std::vector<line> level = {{{center, center}}};
+    std::vector<bookEntry> entries;
+    std::mutex mutex;
+    for (int stones = 1; stones <= options.plies && !level.empty(); ++stones) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<line> next;
+        std::unordered_set<uint64_t> seen;
+        std::atomic<size_t> index{0};
+        std::vector<std::thread> pool;
+        for (int t = 0; t < options.threads; ++t) {
+            pool.emplace_back([&]() {
+                // one engine per thread, taken back to the empty board after each position
+                Game game(UNBOUNDED, options.toWin);
+                game.setHashSize(options.hashMb);
+                if (!options.weights.empty()) {
+                    game.loadWeights(options.weights);
+                }
+                for (size_t i = index++; i < level.size(); i = index++) {
+                    const line& moves = level[i];
+                    game.setSeed(1);
+                    for (const auto& m : moves) {
+                        game.move(m.first, m.second);
+                    }
+                    searchResult result = game.think(options.limits);
+                    bookFrame frame;
+                    uint64_t key = bookKey(stonesOf(moves), game.isMoveX(), frame);
+                    bookEntry entry = {key, result.score, 0, 0, uint8_t(result.depth), 0};
+                    int bx, by;
+                    frame.toBook(result.move.first, result.move.second, bx, by);
+                    entry.x = bx;
+                    entry.y = by;
+
+                    // children: every empty cell near the stones, unless the game is decided
+                    std::vector<line> children;
+                    if (stones < options.plies && std::abs(result.score) < 100000) {
+                        for (const auto& m : moves) {
+                            for (int dx = -options.radius; dx <= options.radius; ++dx) {
+                                for (int dy = -options.radius; dy <= options.radius; ++dy) {
+                                    if (game.isFree(m.first + dx, m.second + dy)) {
+                                        children.push_back(moves);
+                                        children.back().push_back({m.first + dx, m.second + dy});
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    while (game.undo()) {}
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    entries.push_back(entry);
+                    for (auto& child : children) {
+                        bookFrame unused;
+                        if (seen.insert(bookKey(stonesOf(child), (stones + 1) % 2 == 0, unused)).second) {
+                            next.push_back(std::move(child));
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << stones << " stones: " << level.size() << " positions in " << seconds << "s" << std::endl;
+        level = std::move(next);
+    }
+    if (!writeBook(options.out, options.toWin, options.plies, entries)) {
+        std::cerr << "cannot write " << options.out << std::endl;
+        return 1;
+    }
+    std::cerr << entries.size() << " entries written to " << options.out << std::endl;
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+
+#include "ttt.h"
+
+// Headless front end of the engine.
+//
+// One-shot mode plays the given moves from an empty board, searches the position
+// and prints the engine's reply:
+//     ttt_cli --size 15 --win 5 --time 1000 --threads 2 --moves "7,7 7,8 8,8"
+//
+// With --protocol it reads commands from stdin and answers on stdout, following
+// the Gomocup (Piskvork) brain protocol: START, RESTART, BEGIN, TURN, BOARD,
+// TAKEBACK, INFO, ABOUT and END. Search statistics are reported on MESSAGE lines.
+
+const int DEFAULT_SIZE = 15;
+const int DEFAULT_WIN = 5;
+const int TIME_MARGIN = 50; // milliseconds kept for I/O when a turn timeout is given
+
+struct cliOptions {
+    int boardSize = DEFAULT_SIZE;
+    int toWin = DEFAULT_WIN;
+    size_t hashMb = 16;
+    uint32_t seed = 0;
+    bool seeded = false;
+    bool protocol = false;
+    bool stats = false;
+    std::string moves;
+    std::string trace;
+    std::string weights = DEFAULT_WEIGHTS_FILE; // optional unless given explicitly
+    bool weightsGiven = false;
+    std::string bookFile = DEFAULT_BOOK_FILE;   // likewise
+    bool bookGiven = false;
+    std::shared_ptr<const OpeningBook> book;
+    std::string analysisFile;                   // none unless given
+    size_t analysisMb = 0;                      // 0 keeps the store's size
+    std::shared_ptr<AnalysisStore> analysis;
+    searchLimits limits;
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --size N       board size, 0 for unbounded (default " << DEFAULT_SIZE << ")\n"
+              << "  --win N        stones in a row to win, 3 to 5 (default " << DEFAULT_WIN << ")\n"
+              << "  --time MS      time budget per move, 0 for none\n"
+              << "  --depth N      depth limit in plies, 0 for none (default 3)\n"
+              << "  --nodes N      node budget per move, 0 for none\n"
+              << "  --threads N    search threads (default 1)\n"
+              << "  --hash MB      transposition table size (default 16)\n"
+              << "  --seed N       seed of the move tie-breaking\n"
+              << "  --weights FILE evaluation weights (default " << DEFAULT_WEIGHTS_FILE << " if present)\n"
+              << "  --book FILE    opening book (default " << DEFAULT_BOOK_FILE << " if present)\n"
+              << "  --analysis FILE persistent analysis store shared with other processes\n"
+              << "  --analysis-mb MB size of the store, compacting an existing one (default "
+              << DEFAULT_ANALYSIS_MB << " for a new one)\n"
+              << "  --moves LIST   moves played so far, \"x,y x,y ...\", X first\n"
+              << "  --protocol     read Gomocup protocol commands from stdin\n"
+              << "  --stats        print search statistics of every move to stderr\n"
+              << "  --trace FILE   write a Chrome trace of all searches to FILE\n"
+              << "(--stats and --trace need a build with -DTTT_STATS)\n";
+}
+
+bool parseOptions(int argc, char** argv, cliOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--protocol") {
+            options.protocol = true;
+            continue;
+        }
+        if (arg == "--stats") {
+            options.stats = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--size") {
+            options.boardSize = std::atoi(value);
+            options.boardSize = options.boardSize == 0 ? UNBOUNDED : options.boardSize;
+        } else if (arg == "--win") {
+            options.toWin = std::atoi(value);
+        } else if (arg == "--time") {
+            options.limits.milliseconds = std::atoi(value);
+        } else if (arg == "--depth") {
+            options.limits.depth = std::atoi(value);
+        } else if (arg == "--nodes") {
+            options.limits.nodes = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--threads") {
+            options.limits.threads = std::max(1, std::atoi(value));
+        } else if (arg == "--hash") {
+            options.hashMb = std::max(1, std::atoi(value));
+        } else if (arg == "--seed") {
+            options.seed = std::strtoul(value, nullptr, 10);
+            options.seeded = true;
+        } else if (arg == "--moves") {
+            options.moves = value;
+        } else if (arg == "--trace") {
+            options.trace = value;
+        } else if (arg == "--weights") {
+            options.weights = value;
+            options.weightsGiven = true;
+        } else if (arg == "--book") {
+            options.bookFile = value;
+            options.bookGiven = true;
+        } else if (arg == "--analysis") {
+            options.analysisFile = value;
+        } else if (arg == "--analysis-mb") {
+            options.analysisMb = std::max(1, std::atoi(value));
+        } else {
+            return false;
+        }
+    }
+#ifndef TTT_STATS
+    if (options.stats || !options.trace.empty()) {
+        std::cerr << "--stats and --trace need a build with -DTTT_STATS" << std::endl;
+        return false;
+    }
+#endif
+    std::vector<std::pair<int, int>> weights(WEIGHT_GROUPS);
+    if (options.weightsGiven && !readWeights(options.weights, weights)) {
+        std::cerr << "cannot read weights from " << options.weights << std::endl;
+        return false;
+    }
+    std::shared_ptr<OpeningBook> book = std::make_shared<OpeningBook>();
+    if (book->open(options.bookFile)) {
+        options.book = book;
+    } else if (options.bookGiven) {
+        std::cerr << "cannot open book " << options.bookFile << std::endl;
+        return false;
+    }
+    if (!options.analysisFile.empty()) {
+        options.analysis = std::make_shared<AnalysisStore>();
+        if (!options.analysis->open(options.analysisFile, options.analysisMb)) {
+            std::cerr << "cannot open analysis store " << options.analysisFile << std::endl;
+            return false;
+        }
+    }
+    return options.boardSize > 0 && options.toWin >= MIN_WIN && options.toWin <= MAX_WIN;
+}
+
+#ifdef TTT_STATS
+std::vector<traceEvent> traceEvents;
+#endif
+
+// Statistics and trace spans of one engine move.
+void record(const cliOptions& options, const searchResult& result) {
+#ifdef TTT_STATS
+    if (options.stats) {
+        writeStats(std::cerr, result.stats);
+    }
+    if (!options.trace.empty()) {
+        traceEvents.insert(traceEvents.end(), result.stats.trace.begin(), result.stats.trace.end());
+    }
+#endif
+}
+
+void writeTraceFile(const cliOptions& options) {
+#ifdef TTT_STATS
+    if (!options.trace.empty()) {
+        std::ofstream file(options.trace);
+        writeTrace(file, traceEvents);
+    }
+#endif
+}
+
+std::unique_ptr<Game> newGame(const cliOptions& options, int boardSize) {
+    std::unique_ptr<Game> game(new Game(boardSize, options.toWin));
+    game->setHashSize(options.hashMb);
+    game->loadWeights(options.weights);
+    game->setBook(options.book);
+    game->setAnalysis(options.analysis);
+    if (options.seeded) {
+        game->setSeed(options.seed);
+    }
+    return game;
+}
+
+// Reads "x,y" (or "x,y,field"); returns the number of values read.
+int parseCoords(const std::string& text, int* values, int count) {
+    std::stringstream in(text);
+    int read = 0;
+    std::string item;
+    while (read < count && std::getline(in, item, ',')) {
+        char* end;
+        values[read] = std::strtol(item.c_str(), &end, 10);
+        if (end == item.c_str()) {
+            break;
+        }
+        ++read;
+    }
+    return read;
+}
+
+// Of the search alone; the threat solver's nodes and time are not in it.
+double nodesPerSecond(const searchResult& result) {
+    return result.seconds > 0 ? result.nodes / result.seconds : 0;
+}
+
+int runOnce(const cliOptions& options) {
+    std::unique_ptr<Game> game = newGame(options, options.boardSize);
+    std::stringstream in(options.moves);
+    std::string token;
+    while (in >> token) {
+        int c[2];
+        if (parseCoords(token, c, 2) != 2 || !game->isFree(c[0], c[1])) {
+            std::cerr << "invalid move: " << token << std::endl;
+            return 1;
+        }
+        game->move(c[0], c[1]);
+        if (game->checkWin()) {
+            std::cerr << "game already over after " << token << std::endl;
+            return 1;
+        }
+    }
+    searchResult result = game->machineMove(options.limits);
+    record(options, result);
+    writeTraceFile(options);
+    if (result.move.first < 0) {
+        std::cerr << "no move: the board is full" << std::endl;
+        return 1;
+    }
+    std::cout << "move " << result.move.first << "," << result.move.second
+              << " score " << result.score
+              << " depth " << result.depth
+              << " nodes " << result.nodes
+              << " nps " << (uint64_t)nodesPerSecond(result)
+              << " threat-nodes " << result.threatNodes
+              << " time " << (int)((result.threatSeconds + result.seconds) * 1000) << "ms" << std::endl;
+    return 0;
+}
+
+// Searches, plays and reports the engine's move in protocol mode; in a game that
+// is already won or drawn, reports that instead.
+void reply(Game& game, const cliOptions& options) {
+    if (game.checkWin()) {
+        std::cout << "ERROR game is over" << std::endl;
+        return;
+    }
+    if (game.isFull()) {
+        std::cout << "ERROR board is full" << std::endl;
+        return;
+    }
+    searchResult result = game.machineMove(options.limits);
+    record(options, result);
+    std::cout << "MESSAGE depth " << result.depth << " score " << result.score
+              << " nodes " << result.nodes << " nps " << (uint64_t)nodesPerSecond(result)
+              << " threat-nodes " << result.threatNodes << "\n";
+    std::cout << result.move.first << "," << result.move.second << std::endl;
+}
+
+int runProtocol(cliOptions options) {
+    std::unique_ptr<Game> game;
+    int boardSize = options.boardSize;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::stringstream in(line);
+        std::string command;
+        in >> command;
+        for (char& ch : command) {
+            ch = std::toupper(ch);
+        }
+        if (command == "START") {
+            int size = 0;
+            if (!(in >> size) || size < options.toWin) {
+                std::cout << "ERROR unsupported board size" << std::endl;
+                continue;
+            }
+            boardSize = size;
+            game = newGame(options, boardSize);
+            std::cout << "OK" << std::endl;
+        } else if (command == "RESTART") {
+            game = newGame(options, boardSize);
+            std::cout << "OK" << std::endl;
+        } else if (command == "END") {
+            break;
+        } else if (command == "ABOUT") {
+            std::cout << "name=\"ttt\", version=\"1.0\", country=\"\", "
+                      << "comment=\"alpha-beta search with Aho-Corasick evaluation\"" << std::endl;
+        } else if (command == "INFO") {
+            std::string key, value;
+            in >> key >> value;
+            if (key == "timeout_turn") {
+                int ms = std::atoi(value.c_str());
+                options.limits.milliseconds = ms > 0 ? std::max(1, ms - TIME_MARGIN) : 0;
+                options.limits.depth = ms > 0 ? 0 : options.limits.depth;
+            } else if (key == "max_memory") {
+                size_t mb = std::strtoull(value.c_str(), nullptr, 10) / (1024 * 1024);
+                if (mb > 0) {
+                    options.hashMb = std::max<size_t>(1, mb / 2);
+                    if (game) {
+                        game->setHashSize(options.hashMb);
+                    }
+                }
+            } else if (key == "threads") {
+                options.limits.threads = std::max(1, std::atoi(value.c_str()));
+            } else if (key == "depth") {
+                options.limits.depth = std::atoi(value.c_str());
+            }
+            // other keys (timeout_match, time_left, game_type, rule, ...) are ignored
+        } else if (!game) {
+            std::cout << "ERROR no game started" << std::endl;
+        } else if (command == "BEGIN") {
+            reply(*game, options);
+        } else if (command == "TURN") {
+            if (game->checkWin()) {
+                std::cout << "ERROR game is over" << std::endl;
+                continue;
+            }
+            std::string coords;
+            in >> coords;
+            int c[2];
+            if (parseCoords(coords, c, 2) != 2 || !game->isFree(c[0], c[1])) {
+                std::cout << "ERROR invalid move" << std::endl;
+                continue;
+            }
+            game->move(c[0], c[1]);
+            reply(*game, options);
+        } else if (command == "TAKEBACK") {
+            std::string coords;
+            in >> coords;
+            int c[2], x, y;
+            game->getLastMove(x, y);
+            if (parseCoords(coords, c, 2) != 2 || c[0] != x || c[1] != y || !game->undo()) {
+                std::cout << "ERROR invalid takeback" << std::endl;
+                continue;
+            }
+            std::cout << "OK" << std::endl;
+        } else if (command == "BOARD") {
+            // "x,y,1" is our stone, "x,y,2" the opponent's; we play X and move next
+            game = newGame(options, boardSize);
+            bool valid = true;
+            while (std::getline(std::cin, line)) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (line == "DONE") {
+                    break;
+                }
+                int c[3];
+                if (parseCoords(line, c, 3) != 3 || !game->isFree(c[0], c[1])) {
+                    valid = false;
+                    continue;
+                }
+                game->setMoveX(c[2] != 2);
+                game->move(c[0], c[1]);
+            }
+            game->setMoveX(true);
+            if (!valid) {
+                std::cout << "ERROR invalid board" << std::endl;
+                continue;
+            }
+            reply(*game, options);
+        } else {
+            std::cout << "UNKNOWN " << command << std::endl;
+        }
+    }
+    writeTraceFile(options);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    cliOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    return options.protocol ? runProtocol(options) : runOnce(options);
+}
@@ -0,0 +1,339 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Load generator for the game server (server.cpp). Every connection plays many
+// games at once: it opens its sessions, then keeps one PLAY request in flight per
+// game, answering each engine move with a random move near the stones, until the
+// game ends or reaches the given length. Reports throughput and the latency seen
+// by the clients, then the server's own statistics:
+//     g++ -O2 loadgen.cpp -o loadgen -pthread
+//     ./loadgen --socket ttt.sock --connections 16 --games 256 --plies 10 --time 200
+// With --check-deadline it also fails when the p99 latency exceeds the deadline,
+// which a server that is not overloaded should never do.
+
+struct loadOptions {
+    std::string socketPath = "ttt.sock";
+    int port = 0;
+    int connections = 4;
+    int games = 64;      // per connection
+    int plies = 10;      // client moves per game
+    int milliseconds = 200; // deadline of each engine move
+    int boardSize = 15;
+    int toWin = 5;
+    uint32_t seed = 1;
+    bool checkDeadline = false;
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --socket PATH     server socket (default ttt.sock)\n"
+              << "  --port N          connect to 127.0.0.1:N instead\n"
+              << "  --connections N   client connections (default 4)\n"
+              << "  --games N         concurrent games per connection (default 64)\n"
+              << "  --plies N         client moves per game (default 10)\n"
+              << "  --time MS         deadline of each engine move (default 200)\n"
+              << "  --size N          board size, 0 for unbounded (default 15)\n"
+              << "  --win N           stones in a row to win (default 5)\n"
+              << "  --seed N          seed of the client moves (default 1)\n"
+              << "  --check-deadline  fail if the p99 latency exceeds the deadline\n";
+}
+
+bool parseOptions(int argc, char** argv, loadOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--check-deadline") {
+            options.checkDeadline = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--socket") {
+            options.socketPath = value;
+        } else if (arg == "--port") {
+            options.port = std::atoi(value);
+        } else if (arg == "--connections") {
+            options.connections = std::max(1, std::atoi(value));
+        } else if (arg == "--games") {
+            options.games = std::max(1, std::atoi(value));
+        } else if (arg == "--plies") {
+            options.plies = std::max(1, std::atoi(value));
+        } else if (arg == "--time") {
+            options.milliseconds = std::max(0, std::atoi(value));
+        } else if (arg == "--size") {
+            options.boardSize = std::atoi(value);
+        } else if (arg == "--win") {
+            options.toWin = std::atoi(value);
+        } else if (arg == "--seed") {
+            options.seed = std::strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return options.boardSize >= 0 && options.toWin > 0;
+}
+
+int connectTo(const loadOptions& options) {
+    int fd;
+    if (options.port > 0) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, options.socketPath.c_str(), sizeof(address.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Blocking line I/O on a socket.
+class lineSocket {
+public:
+    explicit lineSocket(int fd): fd(fd) {}
+
+    ~lineSocket() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool write(const std::string& text) {
+        size_t done = 0;
+        while (done < text.size()) {
+            ssize_t n = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    bool readLine(std::string& line) {
+        size_t end;
+        while ((end = buffer.find('\n')) == std::string::npos) {
+            char chunk[4096];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(chunk, n);
+        }
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        return true;
+    }
+
+private:
+    int fd;
+    std::string buffer;
+};
+
+struct clientGame {
+    std::unordered_set<uint64_t> stones;
+    std::vector<std::pair<int, int>> moves;
+    int plies = 0;
+    std::pair<int, int> pending;
+    std::chrono::steady_clock::time_point sent;
+};
+
+struct loadTotals {
+    std::mutex mutex;
+    std::vector<uint32_t> micros; // engine moves, request to answer
+    uint64_t games = 0, deadlines = 0, errors = 0;
+};
+
+uint64_t cellKey(int x, int y) {
+    return uint64_t(uint32_t(x)) << 32 | uint32_t(y);
+}
+
+// A free cell at most two cells from a random stone, or the center.
+std::pair<int, int> pickMove(const clientGame& game, int boardSize, std::mt19937& rng) {
+    if (game.moves.empty()) {
+        return {boardSize / 2, boardSize / 2};
+    }
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        const auto& near = game.moves[rng() % game.moves.size()];
+        int x = near.first + int(rng() % 5) - 2, y = near.second + int(rng() % 5) - 2;
+        if (x >= 0 && y >= 0 && x < boardSize && y < boardSize && !game.stones.count(cellKey(x, y))) {
+            return {x, y};
+        }
+    }
+    return {-1, -1};
+}
+
+void runConnection(const loadOptions& options, int index, loadTotals& totals) {
+    int fd = connectTo(options);
+    if (fd < 0) {
+        std::lock_guard<std::mutex> lock(totals.mutex);
+        ++totals.errors;
+        return;
+    }
+    lineSocket server(fd);
+    int boardSize = options.boardSize == 0 ? 1 << 15 : options.boardSize;
+    std::mt19937 rng(options.seed + index);
+    std::stringstream opening;
+    for (int g = 0; g < options.games; ++g) {
+        opening << "NEW " << options.boardSize << " " << options.toWin << "\n";
+    }
+    server.write(opening.str());
+    std::unordered_map<uint32_t, clientGame> games;
+    std::string line;
+    for (int g = 0; g < options.games && server.readLine(line); ++g) {
+        std::stringstream in(line);
+        std::string status;
+        uint32_t id;
+        if (in >> status >> id && status == "OK") {
+            games[id];
+        }
+    }
+
+    std::vector<uint32_t> micros;
+    uint64_t finished = 0, deadlines = 0, errors = 0;
+    auto play = [&](uint32_t id, clientGame& game) {
+        game.pending = pickMove(game, boardSize, rng);
+        if (game.pending.first < 0 || game.plies == options.plies) {
+            return false;
+        }
+        ++game.plies;
+        game.sent = std::chrono::steady_clock::now();
+        std::stringstream request;
+        request << "PLAY " << id << " " << game.pending.first << " " << game.pending.second
+                << " " << options.milliseconds << "\n";
+        return server.write(request.str());
+    };
+    auto place = [](clientGame& game, int x, int y) {
+        game.stones.insert(cellKey(x, y));
+        game.moves.push_back({x, y});
+    };
+    size_t active = 0;
+    for (auto& g : games) {
+        active += play(g.first, g.second);
+    }
+    while (active > 0 && server.readLine(line)) {
+        std::stringstream in(line);
+        std::string status, reason;
+        uint32_t id;
+        if (!(in >> status >> id)) {
+            ++errors;
+            continue;
+        }
+        if (!games.count(id)) {
+            continue; // answer to END
+        }
+        clientGame& game = games[id];
+        bool more = false;
+        if (status == "MOVE") {
+            micros.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - game.sent).count());
+            std::string coords, rest;
+            in >> coords;
+            std::getline(in, rest);
+            int x, y;
+            char comma;
+            std::stringstream(coords) >> x >> comma >> y;
+            place(game, game.pending.first, game.pending.second);
+            place(game, x, y);
+            bool over = rest.find(" win") != std::string::npos || rest.find(" draw") != std::string::npos;
+            more = !over && play(id, game);
+        } else if (status == "ERROR" && in >> reason && reason == "deadline") {
+            // nothing was played; try again with another move
+            ++deadlines;
+            --game.plies;
+            more = play(id, game);
+        } else if (status != "OK") {
+            ++errors;
+        }
+        if (!more) {
+            --active;
+            ++finished;
+            games.erase(id);
+            server.write("END " + std::to_string(id) + "\n");
+        }
+    }
+    std::lock_guard<std::mutex> lock(totals.mutex);
+    totals.micros.insert(totals.micros.end(), micros.begin(), micros.end());
+    totals.games += finished;
+    totals.deadlines += deadlines;
+    totals.errors += errors;
+}
+
+uint32_t percentile(std::vector<uint32_t>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+int main(int argc, char** argv) {
+    loadOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    loadTotals totals;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int c = 0; c < options.connections; ++c) {
+        clients.emplace_back(runConnection, std::cref(options), c, std::ref(totals));
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint32_t p99 = percentile(totals.micros, 0.99);
+    std::cout << totals.games << " games, " << totals.micros.size() << " engine moves in " << seconds << "s ("
+              << (int)(totals.micros.size() / seconds) << " moves/s)\n"
+              << "latency p50 " << percentile(totals.micros, 0.5) / 1000.0
+              << "ms p99 " << p99 / 1000.0
+              << "ms max " << percentile(totals.micros, 1.0) / 1000.0 << "ms\n"
+              << "missed deadlines " << totals.deadlines << ", errors " << totals.errors << std::endl;
+
+    int fd = connectTo(options);
+    if (fd < 0) {
+        std::cerr << "cannot connect to the server" << std::endl;
+        return 1;
+    }
+    lineSocket server(fd);
+    std::string line;
+    if (server.write("STATS\n") && server.readLine(line)) {
+        std::cout << "server: " << line << std::endl;
+    }
+    if (options.checkDeadline && options.milliseconds > 0 && p99 > uint32_t(options.milliseconds) * 1000) {
+        std::cout << "p99 latency over the deadline" << std::endl;
+        return 1;
+    }
+    return totals.errors == 0 ? 0 : 1;
+}
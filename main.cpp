@@ -1,17 +1,22 @@
+#define GL_GLEXT_PROTOTYPES // before any GL header, for render.h
 #include <iostream>
 #include <cmath>
 #include <ctime>
-#include <thread>
-#include <chrono>
+#include <cstdio>
 #include <GL/glut.h>
 #include <GL/freeglut.h>
 
 #include "ttt.h"
+#include "async.h"
+#include "render.h"
 
 const int WINDOW_SIZE = 600;
 const int BOARD_SIZE = 100;
-const int POINTS_TO_WIN = 5;
+const int POINTS_TO_WIN = 5; // MIN_WIN to MAX_WIN, see patterns.h
 const float CELL_SIZE = 0.4f;
+const int POLL_MS = 16; // how often the engine is checked on, about once per frame
+const int EXIT_DELAY_MS = 1000; // time the final position stays on screen
+const bool PONDER = true; // search the expected reply while the human thinks
 
 const float SCALE_INC = 0.1f;
 const float MAX_SCALE = 3.5f, MIN_SCALE = 0.8f;
@@ -20,79 +25,32 @@ float scale = 2.0f;
 float originX = 0.0f;
 float originY = 0.0f;
 bool isDragging = false;
-int startX, startY, lastX, lastY;
+int startX, startY;
 
 bool isMachineMove = false;
+bool isGameOver = false;
 
 enum CursorState { NORMAL, DRAGGING };
 CursorState cursorState = NORMAL;
 
 Game* game = nullptr;
+AsyncSearch engine, ponder;
+std::pair<int, int> expectedReply = {-1, -1};
+BoardRenderer renderer;
 
-void drawO(float x, float y, float r, bool isRed) {
-    if (isRed) {
-        glColor3f(1.0f, 0.0f, 0.0f);
-    }
-    glBegin(GL_POINTS);
-    for (float ang = 0.0f; ang < 2.0f * M_PI; ang += 0.001f) {
-        float c = cos(ang), s = sin(ang);
-        glVertex2f(x + c * r, y + s * r);
-    }
-    glEnd();
-    if (isRed) {
-        glColor3f(0.0f, 0.0f, 0.0f);
-    }
-}
-
-void drawX(float x, float y, float r, bool isRed) {
-    if (isRed) {
-        glColor3f(1.0f, 0.0f, 0.0f);
-    }
-    glBegin(GL_LINES);
-    glVertex2f(x - r, y - r);
-    glVertex2f(x + r, y + r);
-    glVertex2f(x - r, y + r);
-    glVertex2f(x + r, y - r);
-    glEnd();
-    if (isRed) {
-        glColor3f(0.0f, 0.0f, 0.0f);
-    }
+void quit(int) {
+    exit(0);
 }
 
-void drawBoard() {
-     // Draw grid lines
-    glBegin(GL_LINES);
-    float halfCell = CELL_SIZE / 2.0;
-    for (int i = 0; i < BOARD_SIZE + 1; ++i) {
-        // Horizontal lines
-        glVertex2f(-CELL_SIZE * BOARD_SIZE / 2.0 + originX, (i - BOARD_SIZE / 2.0) * CELL_SIZE + originY);
-        glVertex2f(CELL_SIZE * BOARD_SIZE / 2.0 + originX, (i - BOARD_SIZE / 2.0) * CELL_SIZE + originY);
-        // Vertical lines
-        glVertex2f((i - BOARD_SIZE / 2.0) * CELL_SIZE + originX, -CELL_SIZE * BOARD_SIZE / 2.0 + originY);
-        glVertex2f((i - BOARD_SIZE / 2.0) * CELL_SIZE + originX, CELL_SIZE * BOARD_SIZE / 2.0 + originY);
-    }
-    glEnd();
-    float centerX, centerY, radius;
-    bool isLast = false;
-    std::vector<std::vector<int>> board = game->getBoard();
-    for (int i = 0; i < BOARD_SIZE; ++i) {
-        for (int j = 0; j < BOARD_SIZE; ++j) {
-            centerX = ((float)j - (float)BOARD_SIZE / 2.0 + 0.5) * CELL_SIZE + originX;
-            centerY = ((float)BOARD_SIZE / 2.0 - 0.5 - (float)i) * CELL_SIZE + originY;
-            radius = CELL_SIZE / 2.5;
-            isLast = (lastX == i && lastY == j);
-            if (board[i][j] == 1) {
-                drawX(centerX, centerY, radius, isLast);
-            } else if (board[i][j] == 2) {
-                drawO(centerX, centerY, radius, isLast);
-            }
-        }
-    }
-    
+// Plays a move and adds its stone to the picture.
+void play(int x, int y) {
+    game->move(x, y);
+    renderer.addStone(x, y, game->at(x, y));
     glutPostRedisplay();
 }
 
 void checkWin() {
+    int lastX, lastY;
     game->getLastMove(lastX, lastY);
     if (lastX != -1 && lastY != -1 && game->checkWin()) {
         if (game->isMoveX()) {
@@ -100,41 +58,98 @@ void checkWin() {
         } else {
             std::cout << "X won!" << std::endl;
         }
-        glClear(GL_COLOR_BUFFER_BIT);
-        drawBoard();
-        glFlush();
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        std::vector<std::vector<int>> board = game->getBoard();
         for (int i = 40; i < 60; ++i) {
             for (int j = 40; j < 60; ++j) {
-                std::cout << board[i][j] << " ";
+                std::cout << (int)game->at(i, j) << " ";
             }
             std::cout << std::endl;
         }
-        exit(0);
+        isGameOver = true;
+        ponder.cancel();
+        glutTimerFunc(EXIT_DELAY_MS, quit, 0);
+    }
+}
+
+// Starts searching the position after the human's expected reply, so the
+// transposition table is warm if they play it.
+void startPondering() {
+    if (!PONDER || expectedReply.first == -1) {
+        return;
     }
+    Game position(*game);
+    position.move(expectedReply.first, expectedReply.second);
+    if (position.checkWin()) {
+        return;
+    }
+    searchLimits limits;
+    limits.depth = 0;
+    ponder.start(position, limits);
 }
 
+void pollEngine(int);
+
 void machineMove() {
-    game->machineMove();
-    checkWin();
-    isMachineMove = false;
+    ponder.cancel();
+    engine.start(*game, searchLimits());
+    glutTimerFunc(POLL_MS, pollEngine, 0);
+}
+
+// Polls the engine about once per frame while it searches; input stays
+// responsive meanwhile, and nothing runs once it has moved.
+void pollEngine(int) {
+    searchResult result;
+    if (engine.poll(result)) {
+        std::cout << "Best score: " << result.score << ", depth: " << result.depth
+                  << ", nodes: " << result.nodes << std::endl;
+#ifdef TTT_STATS
+        writeStats(std::cout, result.stats);
+#endif
+        isMachineMove = false;
+        if (result.move.first == -1) {
+            std::cout << "Draw!" << std::endl; // the board is full
+            isGameOver = true;
+            glutTimerFunc(EXIT_DELAY_MS, quit, 0);
+            return;
+        }
+        play(result.move.first, result.move.second);
+        glutSetWindowTitle("Tic-Tac-Toe Field");
+        checkWin();
+        expectedReply = result.pv.size() > 1 ? result.pv[1] : std::make_pair(-1, -1);
+        if (!isGameOver) {
+            startPondering();
+        }
+        return;
+    }
+    searchResult progress = engine.progress();
+    char title[128];
+    snprintf(title, sizeof(title), "Tic-Tac-Toe Field - thinking: depth %d, best %d,%d, %llu nodes",
+             progress.depth, progress.move.first, progress.move.second, (unsigned long long)progress.nodes);
+    glutSetWindowTitle(title);
+    glutTimerFunc(POLL_MS, pollEngine, 0);
 }
 
 void myInit(void) {
     glClearColor(1.0, 1.0, 1.0, 0.0);
-    glColor3f(0.0f, 0.0f, 0.0f);
-    glPointSize(3.0);
     glLineWidth(3.0);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluOrtho2D(-scale, scale, -scale, scale);
+    renderer.init(BOARD_SIZE, CELL_SIZE);
+    renderer.setView(scale, originX, originY);
     game = new Game(BOARD_SIZE, POINTS_TO_WIN);
+    if (game->loadWeights(DEFAULT_WEIGHTS_FILE)) {
+        std::cout << "Loaded weights from " << DEFAULT_WEIGHTS_FILE << std::endl;
+    }
+    std::shared_ptr<OpeningBook> book = std::make_shared<OpeningBook>();
+    if (book->open(DEFAULT_BOOK_FILE)) {
+        game->setBook(book);
+        std::cout << "Loaded opening book " << DEFAULT_BOOK_FILE << " (" << book->size() << " positions)" << std::endl;
+    }
 }
 
 void keyboard(unsigned char key, int x, int y) {
-    if (key == 27) // ESC key
+    if (key == 27) { // ESC key
+        engine.cancel();
+        ponder.cancel();
         exit(0);
+    }
 }
 
 void mouseWheel(int button, int dir, int x, int y) {
@@ -144,10 +159,7 @@ void mouseWheel(int button, int dir, int x, int y) {
         scale += SCALE_INC;
     }
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluOrtho2D(-scale, scale, -scale, scale);
-
+    renderer.setView(scale, originX, originY);
     glutPostRedisplay();
 }
 
@@ -165,7 +177,7 @@ void setCursor(CursorState state) {
 }
 
 void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN && !isMachineMove) {
+    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN && !isMachineMove && !isGameOver) {
         float relativeX = (float)x / WINDOW_SIZE * (2.0 * scale) - scale - originX;
         float relativeY = (float)(WINDOW_SIZE - y) / WINDOW_SIZE * (2.0 * scale) - scale - originY;
         float boardNotScaledX = ((CELL_SIZE * (float)BOARD_SIZE / 2.0) - relativeY);
@@ -178,9 +190,15 @@ void mouse(int button, int state, int x, int y) {
         } else {
             int gridX = boardNotScaledX / CELL_SIZE;
             int gridY = boardNotScaledY / CELL_SIZE;
-            game->move(gridX, gridY);
+            if (!game->isFree(gridX, gridY)) {
+                return;
+            }
+            play(gridX, gridY);
             checkWin();
-            isMachineMove = true;
+            if (!isGameOver) {
+                isMachineMove = true;
+                machineMove();
+            }
         }
     } else if (button == GLUT_RIGHT_BUTTON) {
         if (state == GLUT_DOWN) {
@@ -203,18 +221,15 @@ void mouseMotion(int x, int y) {
         originY -= (y - startY) * (2.0 * scale) / glutGet(GLUT_WINDOW_HEIGHT);
         startX = x;
         startY = y;
-
+        renderer.setView(scale, originX, originY);
         glutPostRedisplay();
     }
 }
 
 void myDisplay(void) {
     glClear(GL_COLOR_BUFFER_BIT);
-    drawBoard();
+    renderer.draw();
     glFlush();
-    if (isMachineMove) {
-        machineMove();
-    }
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Evaluation patterns of each supported win length N, generated at compile time.
+// Every shape is one player's stones (1) and empty cells (0) along a line:
+//     group 0  N in a row, the win
+//     group 1  N - 1 in a row open at both ends (for N = 5, the open four)
+//     group 2  N - 1 stones in N cells, one move from a win (four)
+//     group 3  N - 2 stones in the N - 1 inner cells of an N + 1 window with
+//              empty ends (open three)
+//     group 4  N - 3 stones likewise (two)
+// Groups that would hold fewer than two stones are left empty, so 3 in a row has
+// only groups 0 to 2. Group indices are those of the weights (weights.h).
+
+const int MIN_WIN = 3, MAX_WIN = 5;
+
+struct patternShape {
+    int8_t cells[MAX_WIN + 1];
+    int8_t length;
+    int8_t group;
+};
+
+constexpr int binomial(int n, int k) {
+    int r = 1;
+    for (int i = 1; i <= k; ++i) {
+        r = r * (n - k + i) / i;
+    }
+    return k < 0 || k > n ? 0 : r;
+}
+
+constexpr int shapeCount(int n) {
+    int count = 2 + n; // win, open N - 1, N - 1 with a gap
+    for (int g = 3; g <= 4; ++g) {
+        count += n - g + 1 >= 2 ? binomial(n - 1, n - g + 1) : 0;
+    }
+    return count;
+}
+
+template <int N>
+constexpr std::array<patternShape, shapeCount(N)> makeShapes() {
+    static_assert(N >= MIN_WIN && N <= MAX_WIN, "unsupported win length");
+    std::array<patternShape, shapeCount(N)> shapes{};
+    int next = 0;
+    // N in a row
+    shapes[next].length = N;
+    for (int i = 0; i < N; ++i) {
+        shapes[next].cells[i] = 1;
+    }
+    ++next;
+    // N - 1 in a row with open ends
+    shapes[next].length = N + 1;
+    shapes[next].group = 1;
+    for (int i = 1; i < N; ++i) {
+        shapes[next].cells[i] = 1;
+    }
+    ++next;
+    // N cells with one gap, the gap from the last cell to the first
+    for (int gap = N - 1; gap >= 0; --gap, ++next) {
+        shapes[next].length = N;
+        shapes[next].group = 2;
+        for (int i = 0; i < N; ++i) {
+            shapes[next].cells[i] = i != gap;
+        }
+    }
+    // stones in the inner cells of an open N + 1 window, as bit masks over the
+    // N - 1 inner cells in increasing order
+    for (int g = 3; g <= 4; ++g) {
+        int stones = N - g + 1;
+        if (stones < 2) {
+            continue;
+        }
+        for (int mask = 0; mask < 1 << (N - 1); ++mask) {
+            int bits = 0;
+            for (int i = 0; i < N - 1; ++i) {
+                bits += mask >> i & 1;
+            }
+            if (bits != stones) {
+                continue;
+            }
+            shapes[next].length = N + 1;
+            shapes[next].group = g;
+            for (int i = 0; i < N - 1; ++i) {
+                shapes[next].cells[i + 1] = mask >> i & 1;
+            }
+            ++next;
+        }
+    }
+    return shapes;
+}
+
+template <int N>
+constexpr std::array<patternShape, shapeCount(N)> PATTERN_SHAPES = makeShapes<N>();
+
+static_assert(shapeCount(5) == 17 && shapeCount(4) == 9 && shapeCount(3) == 5, "pattern counts");
+static_assert(PATTERN_SHAPES<5>[2].cells[4] == 0 && PATTERN_SHAPES<5>[16].cells[4] == 1, "five-in-a-row shapes");
+
+// The shapes of a win length in [MIN_WIN, MAX_WIN].
+inline std::vector<patternShape> patternShapes(int toWin) {
+    switch (toWin) {
+    case 3:
+        return {PATTERN_SHAPES<3>.begin(), PATTERN_SHAPES<3>.end()};
+    case 4:
+        return {PATTERN_SHAPES<4>.begin(), PATTERN_SHAPES<4>.end()};
+    default:
+        return {PATTERN_SHAPES<5>.begin(), PATTERN_SHAPES<5>.end()};
+    }
+}
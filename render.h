@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES // buffer objects (OpenGL 1.5)
+#endif
+#include <GL/gl.h>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+
+const int CIRCLE_SEGMENTS = 64;
+
+// Retained-mode drawing of the board. The grid and the stones are line segments
+// in board space kept in vertex buffers: the grid is written once, a stone when it
+// is placed. Panning and zooming only change the projection, so a frame is three
+// draw calls whatever the number of stones. Board cell (x, y) is row x from the
+// top and column y from the left; the board is centered on the origin.
+class BoardRenderer {
+public:
+    // Needs a current GL context.
+    void init(int size, float cell) {
+        boardSize = size;
+        cellSize = cell;
+        float half = cellSize * boardSize / 2;
+        std::vector<float> grid;
+        for (int i = 0; i <= boardSize; ++i) {
+            float c = i * cellSize - half;
+            grid.insert(grid.end(), {-half, c, half, c, c, -half, c, half});
+        }
+        gridVertices = grid.size() / 2;
+        glGenBuffers(1, &gridBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, gridBuffer);
+        glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(float), grid.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &stoneBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for (int k = 0; k < CIRCLE_SEGMENTS; ++k) {
+            for (int end = 0; end < 2; ++end) {
+                float angle = 2 * M_PI * (k + end) / CIRCLE_SEGMENTS;
+                circle.push_back(std::cos(angle));
+                circle.push_back(std::sin(angle));
+            }
+        }
+    }
+
+    // Appends the stone's segments; it is drawn highlighted until the next one.
+    void addStone(int x, int y, uint8_t player) {
+        float centerX = (y - boardSize / 2.0f + 0.5f) * cellSize;
+        float centerY = (boardSize / 2.0f - 0.5f - x) * cellSize;
+        float r = cellSize / 2.5f;
+        size_t first = stones.size();
+        if (player == CROSS) {
+            stones.insert(stones.end(), {centerX - r, centerY - r, centerX + r, centerY + r,
+                                         centerX - r, centerY + r, centerX + r, centerY - r});
+        } else if (player == NOUGHT) {
+            for (size_t i = 0; i < circle.size(); i += 2) {
+                stones.push_back(centerX + circle[i] * r);
+                stones.push_back(centerY + circle[i + 1] * r);
+            }
+        } else {
+            return;
+        }
+        lastVertices = (stones.size() - first) / 2;
+        glBindBuffer(GL_ARRAY_BUFFER, stoneBuffer);
+        if (stones.size() > capacity) {
+            capacity = std::max(2 * capacity, std::max(stones.size(), size_t(4096)));
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+            first = 0;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(float), (stones.size() - first) * sizeof(float),
+                        stones.data() + first);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Shows the square [-scale, scale]^2 of the screen, with the board shifted by
+    // (originX, originY).
+    void setView(float scale, float originX, float originY) const {
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glOrtho(-scale - originX, scale - originX, -scale - originY, scale - originY, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+    }
+
+    void draw() const {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glColor3f(0.0f, 0.0f, 0.0f);
+        glBindBuffer(GL_ARRAY_BUFFER, gridBuffer);
+        glVertexPointer(2, GL_FLOAT, 0, nullptr);
+        glDrawArrays(GL_LINES, 0, gridVertices);
+        int vertices = stones.size() / 2;
+        if (vertices > 0) {
+            // the last stone is the tail of the buffer
+            glBindBuffer(GL_ARRAY_BUFFER, stoneBuffer);
+            glVertexPointer(2, GL_FLOAT, 0, nullptr);
+            glDrawArrays(GL_LINES, 0, vertices - lastVertices);
+            glColor3f(1.0f, 0.0f, 0.0f);
+            glDrawArrays(GL_LINES, vertices - lastVertices, lastVertices);
+            glColor3f(0.0f, 0.0f, 0.0f);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+private:
+    int boardSize = 0;
+    float cellSize = 0;
+    GLuint gridBuffer = 0, stoneBuffer = 0;
+    int gridVertices = 0;
+    std::vector<float> circle;  // unit circle as line segments
+    std::vector<float> stones;  // x, y of every stone vertex, in placement order
+    size_t capacity = 0;        // floats allocated in stoneBuffer
+    int lastVertices = 0;
+};
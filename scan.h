@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "board.h"
+
+// Longest pattern the kernels handle.
+const int MAX_PATTERN_LENGTH = 8;
+
+// Pattern trie in kernel form, nodes in preorder with node 0 as the root. Node j
+// at depth k + 1 stands for "cell k is symbol c" with term[j] = k * 3 + c; skip[j]
+// is the first node after its subtree and pattern[j] the pattern ending there or -1.
+struct PatternTerms {
+    int nodes, maxLength;
+    const uint8_t* term;
+    const uint16_t* parent;
+    const uint16_t* skip;
+    const int8_t* pattern;
+};
+
+// Matches all patterns in one direction over a tile of rows. planes[c] holds one
+// 64-bit word per row for symbol c; a pattern starts at bit j of row r iff bit
+// j + k * dy of planes[cells[k]][r + k * dx] is set for every k. The shifted words
+// for every (k, c) are computed once per row, prefixes shared through the trie and
+// subtrees skipped as soon as their prefix matches nowhere. Adds the number of starts
+// among the `owned` bits of rows [0, rows) to counts[i].
+typedef void (*MatchKernel)(const uint64_t* const* planes, const PatternTerms& patterns,
+                            int dx, int dy, int rows, uint64_t owned, int* counts);
+
+inline void matchScalar(const uint64_t* const* planes, const PatternTerms& patterns,
+                        int dx, int dy, int rows, uint64_t owned, int* counts) {
+    uint64_t shifted[MAX_PATTERN_LENGTH * 3];
+    uint64_t prefix[MAX_PATTERN_LENGTH * 64 + 1];
+    for (int r = 0; r < rows; ++r) {
+        for (int k = 0; k < patterns.maxLength; ++k) {
+            for (int c = 0; c < 3; ++c) {
+                uint64_t v = planes[c][r + k * dx];
+                shifted[k * 3 + c] = dy > 0 ? v >> k : dy < 0 ? v << k : v;
+            }
+        }
+        prefix[0] = owned;
+        for (int j = 1; j < patterns.nodes; ) {
+            uint64_t v = prefix[patterns.parent[j]] & shifted[patterns.term[j]];
+            if (v == 0) {
+                j = patterns.skip[j];
+                continue;
+            }
+            prefix[j] = v;
+            if (patterns.pattern[j] >= 0) {
+                counts[patterns.pattern[j]] += __builtin_popcountll(v);
+            }
+            ++j;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2,popcnt")))
+inline void matchSse42(const uint64_t* const* planes, const PatternTerms& patterns,
+                       int dx, int dy, int rows, uint64_t owned, int* counts) {
+    __m128i shifted[MAX_PATTERN_LENGTH * 3];
+    __m128i prefix[MAX_PATTERN_LENGTH * 64 + 1];
+    for (int r = 0; r < rows; r += 2) {
+        for (int k = 0; k < patterns.maxLength; ++k) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            for (int c = 0; c < 3; ++c) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(planes[c] + r + k * dx));
+                shifted[k * 3 + c] = dy > 0 ? _mm_srl_epi64(v, shift) : dy < 0 ? _mm_sll_epi64(v, shift) : v;
+            }
+        }
+        prefix[0] = _mm_set1_epi64x(owned);
+        for (int j = 1; j < patterns.nodes; ) {
+            __m128i v = _mm_and_si128(prefix[patterns.parent[j]], shifted[patterns.term[j]]);
+            if (_mm_testz_si128(v, v)) {
+                j = patterns.skip[j];
+                continue;
+            }
+            prefix[j] = v;
+            if (patterns.pattern[j] >= 0) {
+                counts[patterns.pattern[j]] += _mm_popcnt_u64(_mm_cvtsi128_si64(v)) + _mm_popcnt_u64(_mm_extract_epi64(v, 1));
+            }
+            ++j;
+        }
+    }
+}
+
+__attribute__((target("avx2,popcnt")))
+inline void matchAvx2(const uint64_t* const* planes, const PatternTerms& patterns,
+                      int dx, int dy, int rows, uint64_t owned, int* counts) {
+    __m256i shifted[MAX_PATTERN_LENGTH * 3];
+    __m256i prefix[MAX_PATTERN_LENGTH * 64 + 1];
+    for (int r = 0; r < rows; r += 4) {
+        for (int k = 0; k < patterns.maxLength; ++k) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            for (int c = 0; c < 3; ++c) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(planes[c] + r + k * dx));
+                shifted[k * 3 + c] = dy > 0 ? _mm256_srl_epi64(v, shift) : dy < 0 ? _mm256_sll_epi64(v, shift) : v;
+            }
+        }
+        prefix[0] = _mm256_set1_epi64x(owned);
+        for (int j = 1; j < patterns.nodes; ) {
+            __m256i v = _mm256_and_si256(prefix[patterns.parent[j]], shifted[patterns.term[j]]);
+            if (_mm256_testz_si256(v, v)) {
+                j = patterns.skip[j];
+                continue;
+            }
+            prefix[j] = v;
+            if (patterns.pattern[j] >= 0) {
+                counts[patterns.pattern[j]] += _mm_popcnt_u64(_mm256_extract_epi64(v, 0)) + _mm_popcnt_u64(_mm256_extract_epi64(v, 1))
+                                             + _mm_popcnt_u64(_mm256_extract_epi64(v, 2)) + _mm_popcnt_u64(_mm256_extract_epi64(v, 3));
+            }
+            ++j;
+        }
+    }
+}
+#endif
+
+inline MatchKernel selectMatchKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return matchAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return matchSse42;
+    }
+#endif
+    return matchScalar;
+}
+
+// Counts occurrences of every pattern along all four directions inside a rectangle
+// of the board, the same occurrences an Automatum scan of each line clipped to the
+// rectangle would find. Columns are processed in 64-bit tiles, rows several at a time.
+class PatternScanner {
+public:
+    PatternScanner() {
+        static const MatchKernel best = selectMatchKernel();
+        kernel = best;
+    }
+
+    // Overrides the runtime-selected kernel, e.g. to compare it against matchScalar.
+    void setKernel(MatchKernel k) {
+        kernel = k;
+    }
+
+    // Patterns must be distinct, at most MAX_PATTERN_LENGTH cells long and at most 64.
+    PatternScanner(const std::vector<std::vector<int>>& patterns): PatternScanner() {
+        patternCount = patterns.size();
+        std::vector<std::vector<int>> children(1);
+        std::vector<int> nodeTerm(1, 0), nodePattern(1, -1);
+        for (int i = 0; i < (int)patterns.size(); ++i) {
+            int v = 0;
+            for (int k = 0; k < (int)patterns[i].size(); ++k) {
+                int t = k * ALPH + patterns[i][k], next = -1;
+                for (int u : children[v]) {
+                    if (nodeTerm[u] == t) {
+                        next = u;
+                    }
+                }
+                if (next == -1) {
+                    next = nodeTerm.size();
+                    children[v].push_back(next);
+                    children.emplace_back();
+                    nodeTerm.push_back(t);
+                    nodePattern.push_back(-1);
+                }
+                v = next;
+            }
+            nodePattern[v] = i;
+            maxLength = std::max(maxLength, (int)patterns[i].size());
+        }
+        term.resize(nodeTerm.size());
+        parent.resize(nodeTerm.size());
+        skip.resize(nodeTerm.size());
+        pattern.resize(nodeTerm.size());
+        int next = 0;
+        addPreorder(0, 0, children, nodeTerm, nodePattern, next);
+    }
+
+    int size() const {
+        return patternCount;
+    }
+
+    // counts[i] = occurrences of pattern i in rows [loX, hiX] x columns [loY, hiY].
+    void count(const Board& board, int loX, int loY, int hiX, int hiY, std::vector<int>& counts) {
+        counts.assign(patternCount, 0);
+        // from here on coordinates are relative to the board's first cell
+        loX -= board.firstX(); hiX -= board.firstX();
+        loY -= board.firstY(); hiY -= board.firstY();
+        loX = std::max(loX, 0); loY = std::max(loY, 0);
+        hiX = std::min(hiX, board.size() - 1); hiY = std::min(hiY, board.size() - 1);
+        if (loX > hiX || loY > hiY) {
+            return;
+        }
+        int margin = maxLength - 1;
+        int rows = hiX - loX + 1;
+        int stride = (rows + 3) / 4 * 4 + maxLength + 4; // room for vector loads past the last row
+        for (int c = 0; c < ALPH; ++c) {
+            tile[c].resize(stride);
+            rowPtr[c] = tile[c].data();
+        }
+        for (int c0 = loY - margin; c0 + margin <= hiY; c0 += 64 - 2 * margin) {
+            loadTile(board, loX, rows, c0, loY, hiY);
+            uint64_t owned = columns(c0, std::max(loY, c0 + margin), std::min(hiY, c0 + 63 - margin));
+            PatternTerms patterns = {(int)term.size(), maxLength, term.data(), parent.data(), skip.data(), pattern.data()};
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                kernel(rowPtr, patterns, DIR_X[d], DIR_Y[d], rows, owned, counts.data());
+            }
+        }
+    }
+
+private:
+    static const int ALPH = 3;
+    MatchKernel kernel;
+    int patternCount = 0, maxLength = 1;
+    std::vector<uint8_t> term;
+    std::vector<uint16_t> parent, skip;
+    std::vector<int8_t> pattern;
+    std::vector<uint64_t> tile[ALPH];
+    const uint64_t* rowPtr[ALPH];
+
+    void addPreorder(int v, int from, const std::vector<std::vector<int>>& children,
+                    const std::vector<int>& nodeTerm, const std::vector<int>& nodePattern, int& next) {
+        int j = next++;
+        term[j] = nodeTerm[v];
+        parent[j] = from;
+        pattern[j] = nodePattern[v];
+        for (int u : children[v]) {
+            addPreorder(u, j, children, nodeTerm, nodePattern, next);
+        }
+        skip[j] = next;
+    }
+
+    // Bits of tile columns [from, to] for a tile starting at board column c0.
+    static uint64_t columns(int c0, int from, int to) {
+        if (from > to) {
+            return 0;
+        }
+        int lo = from - c0, hi = to - c0;
+        uint64_t upTo = hi >= 63 ? ~uint64_t(0) : (uint64_t(1) << (hi + 1)) - 1;
+        return upTo & ~((uint64_t(1) << lo) - 1);
+    }
+
+    // 64 bits of a padded plane row starting at bit b, zeros outside the row.
+    static uint64_t bitsAt(const uint64_t* row, int words, int b) {
+        uint64_t result = 0;
+        int w = b >= 0 ? b / 64 : -((-b + 63) / 64);
+        int s = b - w * 64;
+        if (w >= 0 && w < words) {
+            result |= row[w] >> s;
+        }
+        if (s != 0 && w + 1 >= 0 && w + 1 < words) {
+            result |= row[w + 1] << (64 - s);
+        }
+        return result;
+    }
+
+    void loadTile(const Board& board, int loX, int rows, int c0, int loY, int hiY) {
+        uint64_t inside = columns(c0, std::max(loY, c0), std::min(hiY, c0 + 63));
+        int words = board.planeWords(), pad = board.getPadding();
+        const uint64_t* cross = board.plane(CROSS);
+        const uint64_t* nought = board.plane(NOUGHT);
+        for (int r = 0; r < rows; ++r) {
+            int row = (loX + r + pad) * words;
+            uint64_t x = bitsAt(cross + row, words, c0 + pad) & inside;
+            uint64_t o = bitsAt(nought + row, words, c0 + pad) & inside;
+            tile[EMPTY][r] = inside & ~(x | o);
+            tile[CROSS][r] = x;
+            tile[NOUGHT][r] = o;
+        }
+        for (int c = 0; c < ALPH; ++c) {
+            std::fill(tile[c].begin() + rows, tile[c].end(), 0);
+        }
+    }
+};
@@ -0,0 +1,837 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ttt.h"
+
+// Game server: hosts many concurrent games for clients on a Unix domain socket or
+// a localhost TCP port, and answers their move requests from a fixed pool of
+// engine workers:
+//     g++ -O2 server.cpp -o ttt_server -pthread
+//     ./ttt_server --socket ttt.sock --workers 8
+//
+// A session is only its board size, win length and moves. Each worker keeps one
+// Game per board configuration and brings it to a session's position by taking
+// back moves to the common prefix and replaying the rest, so a request costs its
+// search and not an engine. Requests of a session run in order. Across sessions
+// the earliest deadline goes first, and each session queues one request at a
+// time, so a client flooding one game cannot starve the others. Under load a
+// worker takes several requests per visit to the queue.
+//
+// One command per line; answers carry the session id:
+//     NEW SIZE WIN       -> OK ID                  (size 0 for unbounded, win 3 to 5)
+//     MOVE ID X Y        -> OK ID [win|draw]       a move of the side to move
+//     THINK ID [MS]      -> MOVE ID X,Y score S depth D nodes N [win|draw]
+//     PLAY ID X Y [MS]   -> MOVE ... as THINK after the move, or OK ID win|draw
+//     UNDO ID            -> OK ID
+//     END ID             -> OK ID
+//     STATS              -> STATS sessions N queue Q served M p50 US p99 US
+// Errors are "ERROR ID reason". MS is the request's deadline counted from its
+// arrival; a request that reaches a worker too late fails with "deadline" and
+// changes nothing.
+
+const char* const DEFAULT_SOCKET = "ttt.sock";
+const int DEADLINE_MARGIN = 5;     // milliseconds kept for answering, beyond the measured overrun
+const size_t LATENCY_WINDOW = 1 << 16; // answers the percentiles are taken over
+const size_t OVERRUN_WINDOW = 256;  // timed answers the deadline margin is taken over
+
+typedef std::chrono::steady_clock serverClock;
+
+struct serverOptions {
+    std::string socketPath = DEFAULT_SOCKET;
+    int port = 0;         // TCP on localhost instead of the socket when set
+    int workers = std::max(1u, std::thread::hardware_concurrency());
+    int batch = 4;        // most requests a worker takes at once
+    int milliseconds = 1000; // default deadline, 0 for none
+    int reportSeconds = 10;
+    size_t hashMb = 16;
+    std::string weights = DEFAULT_WEIGHTS_FILE; // optional unless given explicitly
+    bool weightsGiven = false;
+    std::shared_ptr<const OpeningBook> book;
+    std::shared_ptr<AnalysisStore> analysis;
+    searchLimits limits;
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --socket PATH   Unix domain socket to listen on (default " << DEFAULT_SOCKET << ")\n"
+              << "  --port N        listen on 127.0.0.1:N instead\n"
+              << "  --workers N     engine threads (default: all cores)\n"
+              << "  --batch N       most requests a worker takes at once (default 4)\n"
+              << "  --time MS       default deadline of a move request, 0 for none (default 1000)\n"
+              << "  --depth N       depth limit in plies, 0 for none (default 3)\n"
+              << "  --threats N     node budget of the threat solver (default 5000)\n"
+              << "  --hash MB       transposition table per worker and board configuration (default 16)\n"
+              << "  --weights FILE  evaluation weights (default " << DEFAULT_WEIGHTS_FILE << " if present)\n"
+              << "  --book FILE     opening book\n"
+              << "  --analysis FILE persistent analysis store\n"
+              << "  --report S      print statistics every S seconds, 0 for never (default 10)\n";
+}
+
+bool parseOptions(int argc, char** argv, serverOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--socket") {
+            options.socketPath = value;
+        } else if (arg == "--port") {
+            options.port = std::atoi(value);
+        } else if (arg == "--workers") {
+            options.workers = std::max(1, std::atoi(value));
+        } else if (arg == "--batch") {
+            options.batch = std::max(1, std::atoi(value));
+        } else if (arg == "--time") {
+            options.milliseconds = std::max(0, std::atoi(value));
+        } else if (arg == "--depth") {
+            options.limits.depth = std::atoi(value);
+        } else if (arg == "--threats") {
+            options.limits.threatNodes = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--hash") {
+            options.hashMb = std::max(1, std::atoi(value));
+        } else if (arg == "--weights") {
+            options.weights = value;
+            options.weightsGiven = true;
+        } else if (arg == "--book") {
+            std::shared_ptr<OpeningBook> book = std::make_shared<OpeningBook>();
+            if (!book->open(value)) {
+                std::cerr << "cannot open book " << value << std::endl;
+                return false;
+            }
+            options.book = book;
+        } else if (arg == "--analysis") {
+            options.analysis = std::make_shared<AnalysisStore>();
+            if (!options.analysis->open(value)) {
+                std::cerr << "cannot open analysis store " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--report") {
+            options.reportSeconds = std::max(0, std::atoi(value));
+        } else {
+            return false;
+        }
+    }
+    std::vector<std::pair<int, int>> weights(WEIGHT_GROUPS);
+    if (options.weightsGiven && !readWeights(options.weights, weights)) {
+        std::cerr << "cannot read weights from " << options.weights << std::endl;
+        return false;
+    }
+    return options.port >= 0 && options.port < 65536;
+}
+
+// A client. The I/O thread reads it; workers append answers under the mutex and
+// send what the socket takes, and the I/O thread flushes the rest once it is
+// writable. fd is -1 once the connection is closed.
+struct connection {
+    int fd;
+    std::mutex mutex;
+    std::string out;
+    std::string in;                 // I/O thread only
+    std::unordered_set<uint32_t> sessions; // I/O thread only: open ones, closed with the connection
+};
+
+enum requestKind : uint8_t {
+    REQUEST_MOVE,
+    REQUEST_THINK,
+    REQUEST_PLAY,
+    REQUEST_UNDO,
+    REQUEST_END
+};
+
+struct request {
+    requestKind kind;
+    int x = -1, y = -1;
+    serverClock::time_point arrival, deadline;
+};
+
+typedef std::vector<std::pair<uint16_t, uint16_t>> moveList; // UNBOUNDED fits 16 bits
+
+struct session {
+    std::shared_ptr<connection> client;
+    int boardSize, toWin;
+    bool over = false;
+    bool busy = false;             // a worker has its first request
+    moveList moves;
+    std::vector<request> pending;  // in arrival order
+};
+
+// A request taken by a worker, with a copy of its session's state that is
+// written back when it is done.
+struct job {
+    uint32_t id;
+    request req;
+    std::shared_ptr<connection> client;
+    int boardSize, toWin;
+    bool over;
+    moveList moves;
+    std::string answer;
+    bool end = false;
+    serverClock::time_point searchUntil = serverClock::time_point::max(); // deadline given to think
+};
+
+// Appends to the connection's output and sends what the socket takes now.
+void sendAnswer(connection& client, const std::string& text, int epoll) {
+    std::lock_guard<std::mutex> lock(client.mutex);
+    if (client.fd < 0) {
+        return;
+    }
+    bool waiting = !client.out.empty(); // the I/O thread is already flushing
+    client.out += text;
+    if (waiting) {
+        return;
+    }
+    ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    client.out.erase(0, sent > 0 ? sent : 0);
+    if (!client.out.empty()) {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.fd = client.fd;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, client.fd, &event);
+    }
+}
+
+// Move latencies, arrival to answer, of the last LATENCY_WINDOW answers.
+class LatencyLog {
+public:
+    void add(uint32_t micros) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (window.size() < LATENCY_WINDOW) {
+            window.push_back(micros);
+        } else {
+            window[next] = micros;
+        }
+        next = (next + 1) % LATENCY_WINDOW;
+        ++total;
+    }
+
+    uint64_t count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+
+    // p in [0, 1]; 0 without answers.
+    uint32_t percentile(double p) {
+        std::vector<uint32_t> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sorted = window;
+        }
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t k = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        return sorted[k];
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<uint32_t> window;
+    size_t next = 0;
+    uint64_t total = 0;
+};
+
+// How long before a request's deadline its search is told to stop: the 99th
+// percentile of how late recent timed answers went out after their search's
+// deadline, plus DEADLINE_MARGIN. The overrun covers the threat solver and the
+// search ending between clock reads, making the move and writing the answer.
+class DeadlineMargin {
+public:
+    DeadlineMargin(): window(OVERRUN_WINDOW, 0) {}
+
+    std::chrono::microseconds get() const {
+        return std::chrono::microseconds(micros.load(std::memory_order_relaxed));
+    }
+
+    void add(serverClock::duration overrun) {
+        std::lock_guard<std::mutex> lock(mutex);
+        window[next] = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(overrun).count());
+        next = (next + 1) % OVERRUN_WINDOW;
+        filled = std::min(filled + 1, OVERRUN_WINDOW);
+        std::vector<int64_t> sorted(window.begin(), window.begin() + filled);
+        size_t k = std::min(filled - 1, size_t(0.99 * filled));
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        micros = sorted[k] + DEADLINE_MARGIN * 1000;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<int64_t> window;
+    size_t next = 0, filled = 0;
+    std::atomic<int64_t> micros{DEADLINE_MARGIN * 1000};
+};
+
+// Sessions and their queued requests. Sessions with a request and no worker on
+// them wait in a queue ordered by the deadline of their first request.
+class Scheduler {
+public:
+    Scheduler(int workers): workers(workers) {}
+
+    uint32_t open(std::shared_ptr<connection> client, int boardSize, int toWin) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t id = nextId++;
+        session& s = sessions[id];
+        s.client = client;
+        s.boardSize = boardSize;
+        s.toWin = toWin;
+        return id;
+    }
+
+    // Drops the session and its queued requests, e.g. when its client leaves.
+    void close(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(id);
+        if (it != sessions.end()) {
+            queued -= it->second.pending.size();
+            sessions.erase(it);
+        }
+    }
+
+    // False if the client has no such session.
+    bool submit(uint32_t id, const connection* client, const request& r) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(id);
+        if (it == sessions.end() || it->second.client.get() != client) {
+            return false;
+        }
+        session& s = it->second;
+        s.pending.push_back(r);
+        ++queued;
+        maxQueued = std::max(maxQueued, queued);
+        if (!s.busy && s.pending.size() == 1) {
+            makeReady(id, s);
+        }
+        return true;
+    }
+
+    // Waits for requests and takes up to batch of them, fewer when there are
+    // not enough to keep the other workers busy too. False when stopping.
+    bool take(std::vector<job>& jobs, int batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait(lock, [&]() { return stopping || !ready.empty(); });
+        if (stopping) {
+            return false;
+        }
+        size_t count = std::min<size_t>(batch, std::max<size_t>(1, ready.size() / workers));
+        while (jobs.size() < count && !ready.empty()) {
+            uint32_t id = ready.top().id;
+            ready.pop();
+            auto it = sessions.find(id);
+            if (it == sessions.end()) {
+                continue; // closed while queued
+            }
+            session& s = it->second;
+            s.busy = true;
+            jobs.push_back({id, s.pending.front(), s.client, s.boardSize, s.toWin, s.over, s.moves});
+            s.pending.erase(s.pending.begin());
+            --queued;
+        }
+        return true;
+    }
+
+    // Writes the jobs' sessions back and queues their next requests. Requests
+    // queued behind an END are answered as for an unknown session.
+    void finish(std::vector<job>& jobs, int epoll) {
+        std::vector<std::pair<std::shared_ptr<connection>, std::string>> dropped;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& j : jobs) {
+            auto it = sessions.find(j.id);
+            if (it == sessions.end()) {
+                continue;
+            }
+            session& s = it->second;
+            if (j.end) {
+                for (size_t i = 0; i < s.pending.size(); ++i) {
+                    dropped.push_back({s.client, "ERROR " + std::to_string(j.id) + " unknown-session\n"});
+                }
+                queued -= s.pending.size();
+                sessions.erase(it);
+                continue;
+            }
+            s.busy = false;
+            s.over = j.over;
+            s.moves = std::move(j.moves);
+            if (!s.pending.empty()) {
+                makeReady(j.id, s);
+            }
+        }
+        lock.unlock();
+        for (auto& d : dropped) {
+            sendAnswer(*d.first, d.second, epoll);
+        }
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wakeup.notify_all();
+    }
+
+    size_t sessionCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sessions.size();
+    }
+
+    size_t queueDepth() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queued;
+    }
+
+    // Deepest queue since the last call.
+    size_t takeMaxQueueDepth() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t depth = maxQueued;
+        maxQueued = queued;
+        return depth;
+    }
+
+private:
+    struct readyEntry {
+        serverClock::time_point deadline;
+        uint64_t order; // arrival order among equal deadlines
+        uint32_t id;
+
+        bool operator<(const readyEntry& other) const {
+            // std::priority_queue puts the greatest first
+            return deadline != other.deadline ? deadline > other.deadline : order > other.order;
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::unordered_map<uint32_t, session> sessions;
+    std::priority_queue<readyEntry> ready;
+    uint32_t nextId = 1;
+    uint64_t nextOrder = 0;
+    size_t queued = 0, maxQueued = 0;
+    int workers;
+    bool stopping = false;
+
+    void makeReady(uint32_t id, const session& s) {
+        ready.push({s.pending.front().deadline, nextOrder++, id});
+        wakeup.notify_one();
+    }
+};
+
+// An engine thread with one Game per board configuration it has served.
+class Worker {
+public:
+    Worker(const serverOptions& options, Scheduler& scheduler, LatencyLog& latencies, DeadlineMargin& margin,
+           int epoll):
+        options(options), scheduler(scheduler), latencies(latencies), margin(margin), epoll(epoll) {}
+
+    void run() {
+        std::vector<job> jobs;
+        while (scheduler.take(jobs, options.batch)) {
+            for (auto& j : jobs) {
+                serve(j);
+                // answered before the session takes its next request, so that a
+                // session's answers go out in order
+                sendAnswer(*j.client, j.answer, epoll);
+                if (j.searchUntil != serverClock::time_point::max()) {
+                    margin.add(serverClock::now() - j.searchUntil);
+                }
+            }
+            scheduler.finish(jobs, epoll);
+            jobs.clear();
+        }
+    }
+
+private:
+    struct engine {
+        std::unique_ptr<Game> game;
+        moveList applied; // moves on game
+    };
+
+    const serverOptions& options;
+    Scheduler& scheduler;
+    LatencyLog& latencies;
+    DeadlineMargin& margin;
+    int epoll;
+    std::map<std::pair<int, int>, engine> engines;
+
+    // The engine for the job's configuration, at the job's position.
+    Game& reach(const job& j) {
+        engine& e = engines[{j.boardSize, j.toWin}];
+        if (!e.game) {
+            e.game.reset(new Game(j.boardSize, j.toWin));
+            e.game->setHashSize(options.hashMb);
+            e.game->loadWeights(options.weights);
+            e.game->setBook(options.book);
+            e.game->setAnalysis(options.analysis);
+        }
+        size_t common = 0;
+        while (common < e.applied.size() && common < j.moves.size() && e.applied[common] == j.moves[common]) {
+            ++common;
+        }
+        while (e.applied.size() > common) {
+            e.game->undo();
+            e.applied.pop_back();
+        }
+        for (size_t i = common; i < j.moves.size(); ++i) {
+            e.game->move(j.moves[i].first, j.moves[i].second);
+            e.applied.push_back(j.moves[i]);
+        }
+        return *e.game;
+    }
+
+    void play(job& j, Game& game, int x, int y) {
+        game.move(x, y);
+        j.moves.push_back({uint16_t(x), uint16_t(y)});
+        engines[{j.boardSize, j.toWin}].applied.push_back(j.moves.back());
+        j.over = game.checkWin() || j.moves.size() == uint64_t(j.boardSize) * j.boardSize;
+    }
+
+    std::string outcome(const job& j, Game& game) {
+        return !j.over ? "" : game.checkWin() ? " win" : " draw";
+    }
+
+    void serve(job& j) {
+        std::string id = std::to_string(j.id);
+        const request& r = j.req;
+        bool thinks = r.kind == REQUEST_THINK || r.kind == REQUEST_PLAY;
+        bool timed = r.deadline != serverClock::time_point::max();
+        int64_t budget = !timed ? 0 : std::chrono::duration_cast<std::chrono::milliseconds>(
+            r.deadline - serverClock::now() - margin.get()).count();
+        if (thinks && timed && budget <= 0) {
+            j.answer = "ERROR " + id + " deadline\n";
+            return;
+        }
+        if (r.kind == REQUEST_END) {
+            j.end = true;
+            j.answer = "OK " + id + "\n";
+            return;
+        }
+        Game& game = reach(j);
+        if (r.kind == REQUEST_UNDO) {
+            if (j.moves.empty()) {
+                j.answer = "ERROR " + id + " nothing-to-undo\n";
+                return;
+            }
+            game.undo();
+            j.moves.pop_back();
+            engines[{j.boardSize, j.toWin}].applied.pop_back();
+            j.over = false;
+            j.answer = "OK " + id + "\n";
+            return;
+        }
+        if (j.over) {
+            j.answer = "ERROR " + id + " game-over\n";
+            return;
+        }
+        if (r.kind == REQUEST_MOVE || r.kind == REQUEST_PLAY) {
+            if (r.x < 0 || r.y < 0 || r.x >= j.boardSize || r.y >= j.boardSize || !game.isFree(r.x, r.y)) {
+                j.answer = "ERROR " + id + " invalid-move\n";
+                return;
+            }
+            play(j, game, r.x, r.y);
+            if (r.kind == REQUEST_MOVE || j.over) {
+                j.answer = "OK " + id + outcome(j, game) + "\n";
+                return;
+            }
+        }
+        searchLimits limits = options.limits;
+        if (timed) {
+            limits.milliseconds = std::max<int64_t>(1, budget);
+            j.searchUntil = serverClock::now() + std::chrono::milliseconds(limits.milliseconds);
+        }
+        searchResult result = game.think(limits);
+        if (result.move.first < 0) {
+            j.over = true; // the board is full
+            j.answer = "ERROR " + id + " game-over\n";
+            return;
+        }
+        play(j, game, result.move.first, result.move.second);
+        std::stringstream answer;
+        answer << "MOVE " << id << " " << result.move.first << "," << result.move.second
+               << " score " << result.score << " depth " << result.depth << " nodes " << result.nodes
+               << outcome(j, game) << "\n";
+        j.answer = answer.str();
+        latencies.add(std::chrono::duration_cast<std::chrono::microseconds>(serverClock::now() - r.arrival).count());
+    }
+};
+
+volatile std::sig_atomic_t interrupted = 0;
+
+void onSignal(int) {
+    interrupted = 1;
+}
+
+int listenOn(const serverOptions& options) {
+    int fd;
+    if (options.port > 0) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+    } else {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (options.socketPath.size() >= sizeof(address.sun_path)) {
+            return -1;
+        }
+        std::strcpy(address.sun_path, options.socketPath.c_str());
+        unlink(options.socketPath.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            return -1;
+        }
+    }
+    return listen(fd, SOMAXCONN) == 0 ? fd : -1;
+}
+
+// The I/O thread: accepts clients, parses their commands and flushes answers.
+class Server {
+public:
+    Server(const serverOptions& options): options(options), scheduler(options.workers) {}
+
+    int run() {
+        int listener = listenOn(options);
+        if (listener < 0) {
+            std::cerr << "cannot listen on "
+                      << (options.port > 0 ? "port " + std::to_string(options.port) : options.socketPath) << std::endl;
+            return 1;
+        }
+        epoll = epoll_create1(0);
+        watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+        std::vector<std::thread> pool;
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (int w = 0; w < options.workers; ++w) {
+            workers.emplace_back(new Worker(options, scheduler, latencies, margin, epoll));
+            pool.emplace_back(&Worker::run, workers.back().get());
+        }
+        std::cerr << "listening on " << (options.port > 0 ? "127.0.0.1:" + std::to_string(options.port) : options.socketPath)
+                  << " with " << options.workers << " workers" << std::endl;
+
+        auto lastReport = serverClock::now();
+        uint64_t lastServed = 0;
+        epoll_event events[256];
+        while (!interrupted) {
+            int n = epoll_wait(epoll, events, 256, 1000);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listener) {
+                    accept(listener);
+                    continue;
+                }
+                auto it = clients.find(fd);
+                if (it == clients.end()) {
+                    continue;
+                }
+                std::shared_ptr<connection> client = it->second;
+                if ((events[i].events & EPOLLOUT) && !flush(*client)) {
+                    disconnect(client);
+                    continue;
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !receive(client)) {
+                    disconnect(client);
+                }
+            }
+            double seconds = std::chrono::duration<double>(serverClock::now() - lastReport).count();
+            if (options.reportSeconds > 0 && seconds >= options.reportSeconds) {
+                uint64_t served = latencies.count();
+                std::cerr << statistics() << " max-queue " << scheduler.takeMaxQueueDepth()
+                          << " moves/s " << (int)((served - lastServed) / seconds)
+                          << " margin-us " << margin.get().count() << std::endl;
+                lastServed = served;
+                lastReport = serverClock::now();
+            }
+        }
+        scheduler.stop();
+        for (auto& t : pool) {
+            t.join();
+        }
+        if (options.port == 0) {
+            unlink(options.socketPath.c_str());
+        }
+        return 0;
+    }
+
+private:
+    const serverOptions& options;
+    Scheduler scheduler;
+    LatencyLog latencies;
+    DeadlineMargin margin;
+    int epoll = -1;
+    std::unordered_map<int, std::shared_ptr<connection>> clients;
+
+    void watch(int fd, uint32_t events, int operation) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll, operation, fd, &event);
+    }
+
+    void accept(int listener) {
+        int fd;
+        while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+            if (options.port > 0) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            std::shared_ptr<connection> client = std::make_shared<connection>();
+            client->fd = fd;
+            clients[fd] = client;
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void disconnect(const std::shared_ptr<connection>& client) {
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            fd = client->fd;
+            epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+            ::close(fd);
+            client->fd = -1;
+        }
+        for (uint32_t id : client->sessions) {
+            scheduler.close(id);
+        }
+        clients.erase(fd);
+    }
+
+    // False if the connection failed.
+    bool flush(connection& client) {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        client.out.erase(0, sent > 0 ? sent : 0);
+        if (client.out.empty()) {
+            watch(client.fd, EPOLLIN, EPOLL_CTL_MOD);
+        }
+        return true;
+    }
+
+    // Reads what has arrived and handles the complete lines, also those sent
+    // just before the client closed; false when the client has gone.
+    bool receive(const std::shared_ptr<connection>& client) {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(client->fd, buffer, sizeof(buffer), 0)) > 0) {
+            client->in.append(buffer, n);
+        }
+        bool open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        size_t start = 0, end;
+        while ((end = client->in.find('\n', start)) != std::string::npos) {
+            handle(client, client->in.substr(start, end - start));
+            start = end + 1;
+        }
+        client->in.erase(0, start);
+        return open;
+    }
+
+    std::string statistics() {
+        std::stringstream line;
+        line << "STATS sessions " << scheduler.sessionCount() << " queue " << scheduler.queueDepth()
+             << " served " << latencies.count()
+             << " p50 " << latencies.percentile(0.5) << " p99 " << latencies.percentile(0.99);
+        return line.str();
+    }
+
+    void handle(const std::shared_ptr<connection>& client, std::string line) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::stringstream in(line);
+        std::string command;
+        if (!(in >> command)) {
+            return;
+        }
+        for (char& ch : command) {
+            ch = std::toupper(ch);
+        }
+        if (command == "NEW") {
+            int size, toWin;
+            if (!(in >> size >> toWin) || size < 0 || size > UNBOUNDED || toWin < MIN_WIN || toWin > MAX_WIN
+                || (size != 0 && size < toWin)) {
+                sendAnswer(*client, "ERROR 0 invalid-game\n", epoll);
+                return;
+            }
+            uint32_t id = scheduler.open(client, size == 0 ? UNBOUNDED : size, toWin);
+            client->sessions.insert(id);
+            sendAnswer(*client, "OK " + std::to_string(id) + "\n", epoll);
+            return;
+        }
+        if (command == "STATS") {
+            sendAnswer(*client, statistics() + "\n", epoll);
+            return;
+        }
+        request r;
+        if (command == "MOVE") {
+            r.kind = REQUEST_MOVE;
+        } else if (command == "THINK") {
+            r.kind = REQUEST_THINK;
+        } else if (command == "PLAY") {
+            r.kind = REQUEST_PLAY;
+        } else if (command == "UNDO") {
+            r.kind = REQUEST_UNDO;
+        } else if (command == "END") {
+            r.kind = REQUEST_END;
+        } else {
+            sendAnswer(*client, "UNKNOWN " + command + "\n", epoll);
+            return;
+        }
+        uint32_t id = 0;
+        bool valid = bool(in >> id);
+        if (r.kind == REQUEST_MOVE || r.kind == REQUEST_PLAY) {
+            valid = valid && in >> r.x >> r.y;
+        }
+        int ms = options.milliseconds;
+        if (r.kind == REQUEST_THINK || r.kind == REQUEST_PLAY) {
+            in >> ms;
+        }
+        if (!valid) {
+            sendAnswer(*client, "ERROR " + std::to_string(id) + " invalid-command\n", epoll);
+            return;
+        }
+        r.arrival = serverClock::now();
+        r.deadline = ms > 0 ? r.arrival + std::chrono::milliseconds(ms) : serverClock::time_point::max();
+        if (!scheduler.submit(id, client.get(), r)) {
+            sendAnswer(*client, "ERROR " + std::to_string(id) + " unknown-session\n", epoll);
+        } else if (r.kind == REQUEST_END) {
+            client->sessions.erase(id); // the END request closes it
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    serverOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+    Server server(options);
+    return server.run();
+}
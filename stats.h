@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Search instrumentation, compiled in only with -DTTT_STATS. Without it the
+// TTT_PHASE and TTT_COUNT hooks expand to nothing and searchResult carries no
+// statistics, so the default build pays nothing.
+
+enum statPhase {
+    PHASE_SEARCH = 0,         // getBestScore, inclusive of everything below
+    PHASE_ORDER_MOVES,
+    PHASE_MOVE_GEN,           // getAvailableMoves
+    PHASE_EVALUATE_MOVE,
+    PHASE_EVALUATE_POSITION,
+    PHASE_CHECK_WIN,
+    PHASE_FIND_WIN,           // immediate wins and blocks before the search
+    PHASE_THREATS,            // VCF/VCT solver
+    PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "search", "orderMoves", "getAvailableMoves", "evaluateMove",
+    "evaluatePosition", "checkWin", "findWin", "solveThreats"
+};
+
+inline uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One span of the Chrome trace timeline.
+struct traceEvent {
+    std::string name;
+    int thread;
+    uint64_t start, duration; // microseconds
+};
+
+// Counters of one engine move, summed over all search threads.
+struct searchStats {
+    static const int MAX_PLY = 65; // Game::maxDepth plies and the root
+    static const int MAX_INDEX = 32; // cutoffs at later move indices share the last bucket
+
+    uint64_t nodes[MAX_PLY] = {};
+    uint64_t cutoffs[MAX_INDEX] = {};
+    uint64_t phaseNanos[PHASE_COUNT] = {};
+    uint64_t phaseCalls[PHASE_COUNT] = {};
+    uint64_t ttProbes = 0, ttHits = 0, ttCutoffs = 0;
+    uint64_t windowLookups = 0, lineScans = 0; // evaluateMove: window table vs automaton
+    std::vector<traceEvent> trace;
+
+    void add(const searchStats& other) {
+        for (int i = 0; i < MAX_PLY; ++i) {
+            nodes[i] += other.nodes[i];
+        }
+        for (int i = 0; i < MAX_INDEX; ++i) {
+            cutoffs[i] += other.cutoffs[i];
+        }
+        for (int i = 0; i < PHASE_COUNT; ++i) {
+            phaseNanos[i] += other.phaseNanos[i];
+            phaseCalls[i] += other.phaseCalls[i];
+        }
+        ttProbes += other.ttProbes;
+        ttHits += other.ttHits;
+        ttCutoffs += other.ttCutoffs;
+        windowLookups += other.windowLookups;
+        lineScans += other.lineScans;
+        trace.insert(trace.end(), other.trace.begin(), other.trace.end());
+    }
+
+    void cutoff(int index) {
+        ++cutoffs[index < MAX_INDEX ? index : MAX_INDEX - 1];
+    }
+
+    void span(const std::string& name, int thread, uint64_t start) {
+        trace.push_back({name, thread, start, nowMicros() - start});
+    }
+};
+
+// Adds the lifetime of the scope to a phase.
+class phaseTimer {
+public:
+    phaseTimer(searchStats& stats, statPhase phase): stats(stats), phase(phase),
+        start(std::chrono::steady_clock::now()) {}
+
+    ~phaseTimer() {
+        stats.phaseNanos[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        ++stats.phaseCalls[phase];
+    }
+
+private:
+    searchStats& stats;
+    statPhase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef TTT_STATS
+#define TTT_STATS_CONCAT_(a, b) a##b
+#define TTT_STATS_CONCAT(a, b) TTT_STATS_CONCAT_(a, b)
+#define TTT_PHASE(stats, phase) phaseTimer TTT_STATS_CONCAT(phaseTimer_, __LINE__)(stats, phase)
+#define TTT_COUNT(...) __VA_ARGS__
+#else
+#define TTT_PHASE(stats, phase)
+#define TTT_COUNT(...)
+#endif
+
+// Per-move summary: nodes per depth, where cutoffs happen, time per phase and
+// cache hit rates. Phase times are inclusive, so nested phases overlap.
+inline void writeStats(std::ostream& out, const searchStats& stats) {
+    uint64_t total = 0;
+    for (uint64_t n : stats.nodes) {
+        total += n;
+    }
+    out << "nodes by depth:";
+    for (int d = 0; d < searchStats::MAX_PLY; ++d) {
+        if (stats.nodes[d] != 0) {
+            out << " " << d << ":" << stats.nodes[d];
+        }
+    }
+    uint64_t cutoffs = 0;
+    for (uint64_t c : stats.cutoffs) {
+        cutoffs += c;
+    }
+    out << "\ncutoffs by move index (" << cutoffs << "):";
+    for (int i = 0; i < searchStats::MAX_INDEX; ++i) {
+        if (stats.cutoffs[i] != 0) {
+            out << " " << i << (i == searchStats::MAX_INDEX - 1 ? "+" : "") << ":"
+                << 100.0 * stats.cutoffs[i] / cutoffs << "%";
+        }
+    }
+    out << "\nphases:";
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        if (stats.phaseCalls[p] != 0) {
+            out << "\n  " << PHASE_NAMES[p] << ": " << stats.phaseNanos[p] / 1e6 << " ms, "
+                << stats.phaseCalls[p] << " calls, " << double(stats.phaseNanos[p]) / stats.phaseCalls[p] << " ns/call";
+        }
+    }
+    out << "\ntt: " << stats.ttProbes << " probes, "
+        << (stats.ttProbes ? 100.0 * stats.ttHits / stats.ttProbes : 0) << "% hits, "
+        << stats.ttCutoffs << " cutoffs";
+    uint64_t evaluations = stats.windowLookups + stats.lineScans;
+    out << "\nwindow table: " << (evaluations ? 100.0 * stats.windowLookups / evaluations : 0)
+        << "% of " << evaluations << " move evaluations\n";
+}
+
+// Chrome trace ("Trace Event Format") JSON, loadable in chrome://tracing or Perfetto.
+inline void writeTrace(std::ostream& out, const std::vector<traceEvent>& events) {
+    out << "{\"traceEvents\": [\n";
+    for (size_t i = 0; i < events.size(); ++i) {
+        const traceEvent& e = events[i];
+        out << "  {\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+            << ", \"ts\": " << e.start << ", \"dur\": " << e.duration << "}"
+            << (i + 1 < events.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+// Zobrist key of a stone of the given player on (x, y). Keys are derived from the
+// coordinates (splitmix64) rather than stored, so they do not depend on board size.
+inline uint64_t zobristKey(int x, int y, uint8_t player) {
+    uint64_t z = (uint64_t(uint32_t(x)) << 32 | uint32_t(y)) * 2 + player;
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Toggled into the key when O is to move.
+const uint64_t SIDE_KEY = 0x5bd1e9955bd1e995ULL;
+
+enum Bound : uint8_t {
+    BOUND_NONE = 0,
+    BOUND_UPPER = 1, // score <= value
+    BOUND_LOWER = 2, // score >= value
+    BOUND_EXACT = 3
+};
+
+struct ttEntry {
+    int score;
+    int moveX, moveY;
+    int depth;
+    Bound bound;
+};
+
+// Probe outcomes counted by one search thread, added to the table's totals when
+// its search ends rather than on every probe.
+struct ttCounters {
+    uint64_t hits = 0, misses = 0, collisions = 0;
+};
+
+// Fixed-size hash table of search results. Each slot stores (key ^ data, data) in two
+// independent 64-bit words, so a torn write from a concurrent store fails the key
+// check on probe instead of returning a corrupted entry. Buckets hold two slots: one
+// kept for the deepest result, one always replaced.
+class TranspositionTable {
+public:
+    TranspositionTable(size_t megabytes = 16) {
+        resize(megabytes);
+    }
+
+    // Rounds the size down to a power of two number of buckets.
+    void resize(size_t megabytes) {
+        size_t buckets = 1;
+        while (buckets * 2 * sizeof(bucket) <= megabytes * 1024 * 1024) {
+            buckets *= 2;
+        }
+        table.reset(new bucket[buckets]);
+        mask = buckets - 1;
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= mask; ++i) {
+            for (auto& s : table[i].slots) {
+                s.key.store(0, std::memory_order_relaxed);
+                s.data.store(0, std::memory_order_relaxed);
+            }
+        }
+        hitCount = 0; missCount = 0; collisionCount = 0;
+    }
+
+    size_t sizeInBytes() const {
+        return (mask + 1) * sizeof(bucket);
+    }
+
+    bool probe(uint64_t key, ttEntry& entry) {
+        ttCounters unused;
+        return probe(key, entry, unused);
+    }
+
+    bool probe(uint64_t key, ttEntry& entry, ttCounters& counters) {
+        bucket& b = table[key & mask];
+        bool occupied = false;
+        for (auto& s : b.slots) {
+            uint64_t data = s.data.load(std::memory_order_relaxed);
+            uint64_t check = s.key.load(std::memory_order_relaxed);
+            if (data == 0) {
+                continue;
+            }
+            if ((check ^ data) == key) {
+                unpack(data, entry);
+                ++counters.hits;
+                return true;
+            }
+            occupied = true;
+        }
+        ++(occupied ? counters.collisions : counters.misses);
+        return false;
+    }
+
+    void store(uint64_t key, int depth, Bound bound, int score, int moveX, int moveY) {
+        uint64_t data = pack(depth, bound, score, moveX, moveY);
+        bucket& b = table[key & mask];
+        slot& deep = b.slots[0];
+        uint64_t deepData = deep.data.load(std::memory_order_relaxed);
+        bool same = (deep.key.load(std::memory_order_relaxed) ^ deepData) == key;
+        slot& target = deepData == 0 || same || depth + 1 >= int(deepData >> 56) ? deep : b.slots[1];
+        target.key.store(key ^ data, std::memory_order_relaxed);
+        target.data.store(data, std::memory_order_relaxed);
+    }
+
+    // depth:8 | bound:2 | score:22 | moveX:16 | moveY:16; never 0 for a stored entry.
+    // Also the slot format of the analysis store (analysis.h).
+    static uint64_t pack(int depth, Bound bound, int score, int moveX, int moveY) {
+        return uint64_t(uint8_t(depth + 1)) << 56 | uint64_t(bound) << 54
+             | uint64_t(uint32_t(score) & 0x3fffff) << 32
+             | uint64_t(uint16_t(moveX)) << 16 | uint16_t(moveY);
+    }
+
+    static void unpack(uint64_t data, ttEntry& entry) {
+        entry.depth = int(data >> 56) - 1;
+        entry.bound = Bound(data >> 54 & 3);
+        entry.score = int32_t(uint32_t(data >> 32 & 0x3fffff) << 10) >> 10;
+        entry.moveX = int16_t(data >> 16);
+        entry.moveY = int16_t(data);
+    }
+
+    void addCounts(const ttCounters& counters) {
+        hitCount.fetch_add(counters.hits, std::memory_order_relaxed);
+        missCount.fetch_add(counters.misses, std::memory_order_relaxed);
+        collisionCount.fetch_add(counters.collisions, std::memory_order_relaxed);
+    }
+
+    uint64_t hits() const {
+        return hitCount.load(std::memory_order_relaxed);
+    }
+
+    // Probes that found nothing in a bucket holding no other positions.
+    uint64_t misses() const {
+        return missCount.load(std::memory_order_relaxed);
+    }
+
+    // Probes that found the bucket occupied by other positions.
+    uint64_t collisions() const {
+        return collisionCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct slot {
+        std::atomic<uint64_t> key{0}, data{0};
+    };
+    struct bucket {
+        slot slots[2];
+    };
+
+    std::unique_ptr<bucket[]> table;
+    size_t mask = 0;
+    std::atomic<uint64_t> hitCount{0}, missCount{0}, collisionCount{0};
+};
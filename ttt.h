@@ -1,22 +1,77 @@
+#pragma once
+
 #include <algorithm>
 #include <vector>
 #include <random>
 #include <queue>
+#include <map>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <functional>
 
-const int ALPH_SIZE = 3;
+#include "board.h"
+#include "scan.h"
+#include "tt.h"
+#include "stats.h"
+#include "weights.h"
+#include "patterns.h"
+#include "book.h"
+#include "analysis.h"
 
-struct node {
-    int counter = 0;
-    int parentIdx = 0, patternIdx = 0;
-    bool terminal = false;
-    node* go[ALPH_SIZE];
-    node* link;
-    node* parent;
-};
+const int ALPH_SIZE = 3;
 
 struct pattern {
     std::vector<int> data;
     int once, more;
+    int group; // index into Game::group
+};
+
+// Best move of the deepest completed iteration.
+struct searchResult {
+    std::pair<int, int> move = {-1, -1};
+    int score = 0;
+    int depth = 0;
+    uint64_t nodes = 0;   // of the alpha-beta search alone
+    double seconds = 0;
+    uint64_t threatNodes = 0; // of the threat solver run before it
+    double threatSeconds = 0;
+    std::vector<std::pair<int, int>> pv;
+#ifdef TTT_STATS
+    searchStats stats;
+#endif
+};
+
+// Limits of one engine move; zero means unlimited.
+struct searchLimits {
+    int depth = 3;         // plies
+    int milliseconds = 0;
+    uint64_t nodes = 0;
+    int threads = 1;
+    bool threatPruning = false; // facing a five threat, search only wins and blocks
+    uint64_t threatNodes = 5000; // budget of the VCF/VCT solver run first, 0 disables it
+    int threatPlies = 21;
+    const std::atomic<bool>* cancel = nullptr; // stops the search when set from another thread
+    std::function<void(const searchResult&)> progress; // called after every completed iteration
+};
+
+// State shared by the threads of one search.
+struct searchShared {
+    std::atomic<bool> stop{false}; // read at every node, so kept off the counter's line
+    alignas(64) std::atomic<uint64_t> nodes{0};
+    std::mutex mutex;
+    searchResult best; // deepest iteration completed by any thread
+
+    void publish(const searchResult& result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result.depth > best.depth) {
+            best = result;
+        }
+    }
 };
 
 struct moveWithEval {
@@ -24,140 +79,222 @@ struct moveWithEval {
     int eval;
 };
 
+// A cell where a player would make a threat, for the threat solver.
+struct threatCell {
+    std::pair<int, int> move;
+    uint64_t made[2]; // [player - 1]: patterns the player would newly make there
+};
+
 int dist(std::pair<int, int>& a, std::pair<int, int>& b) {
     return std::min(std::abs(a.first - b.first), std::abs(a.second - b.second));
 }
 
+// Patterns matched so far: bit i of `once` is set after the first occurrence of
+// pattern i, bit i of `more` after the second one.
+struct hits {
+    uint64_t once = 0, more = 0;
+
+    void add(const hits& other) {
+        more |= other.more | (once & other.once);
+        once |= other.once;
+    }
+};
+
+// Longest line window with a precomputed table (3^13 entries).
+const int MAX_WINDOW = 13;
+
+// Aho–Corasick automaton over the cell alphabet, compiled into flat tables:
+// go[state * ALPH_SIZE + cell] is the next state and output[state] has bit i set
+// if pattern i ends in that state (suffix links included).
 class Automatum {
 public:
     Automatum() = default;
-    Automatum(const std::vector<pattern>& patterns) {
-        root = new node();
-        terminalNodes = 0;
+    Automatum(const std::vector<pattern>& patterns, int windowLength = 0) {
+        for (const auto& p : patterns) {
+            weights.push_back({p.once, p.more});
+        }
         buildTrie(patterns);
         buildAuto();
+        if (windowLength > 0 && windowLength <= MAX_WINDOW) {
+            buildWindows(windowLength);
+        }
     }
 
-    int getTerminalNodes() {
-        return terminalNodes;
+    bool hasWindows() const {
+        return !windowClass.empty();
     }
 
-    void processText(std::vector<std::vector<int>>& board, 
-                     int startX, int startY, 
-                     int finishX, int finishY,
-                     int incX, int incY,
-                     bool leqX, bool leqY) { // true: coord <= finish
-        node* v = root;
-        for (int x = startX, y = startY;
-            !(leqX ^ (x <= finishX)) && !(leqY ^ (y <= finishY)); 
-             x += incX, y += incY) {
-            v = v->go[board[x][y]];
-            v->counter++;
-        }
+    // Hits of a full window given its base-3 code (first scanned cell is the lowest digit).
+    const hits& window(uint32_t code) const {
+        return classes[windowClass[code]];
     }
 
-    void getResults(std::vector<int>& results) {
-        if (results.size() != terminalNodes) {
-            results.resize(terminalNodes);
+    void processText(const LineView& line, hits& h) const {
+        int v = 0;
+        const uint8_t* cell = line.first;
+        for (int i = 0; i < line.length; ++i, cell += line.step) {
+            v = go[v * ALPH_SIZE + *cell];
+            uint64_t out = output[v];
+            h.more |= h.once & out;
+            h.once |= out;
         }
-        propagate();
-        for (auto v : nodes) {
-            if (v->terminal) {
-                results[v->patternIdx] = v->counter;
-            }
-        }
-        clear();
     }
 
-    ~Automatum() {
-        deleteTrie();
+    // Score of pattern i: `once` if it occurred once, `more` if it occurred again.
+    int weight(const hits& h, int i) const {
+        return (h.more >> i & 1) ? weights[i].second : weights[i].first;
     }
+
+    int score(const hits& h) const {
+        int answer = 0;
+        for (uint64_t m = h.once; m != 0; m &= m - 1) {
+            answer += weight(h, __builtin_ctzll(m));
+        }
+        return answer;
+    }
+
 private:
-    node* root;
-    std::vector<node*> nodes;
-    int terminalNodes;
+    std::vector<uint16_t> go;
+    std::vector<uint16_t> link;
+    std::vector<uint64_t> output;
+    std::vector<std::pair<int, int>> weights;
+    std::vector<uint16_t> windowClass; // window code -> index into classes
+    std::vector<hits> classes;         // distinct hits of all windows
+
+    int addState() {
+        go.insert(go.end(), ALPH_SIZE, 0);
+        link.push_back(0);
+        output.push_back(0);
+        return output.size() - 1;
+    }
 
     void buildTrie(const std::vector<pattern>& patterns) {
-        for (int i = 0; i < patterns.size(); ++i) {
-            node* v = root;
+        addState();
+        for (int i = 0; i < (int)patterns.size(); ++i) {
+            int v = 0;
             for (auto &branch : patterns[i].data) {
-                if (v->go[branch] == nullptr) {
-                    v->go[branch] = new node();
-                    v->go[branch]->parent = v;
-                    v->go[branch]->parentIdx = branch;
+                if (go[v * ALPH_SIZE + branch] == 0) {
+                    int u = addState();
+                    go[v * ALPH_SIZE + branch] = u;
                 }
-                v = v->go[branch];
+                v = go[v * ALPH_SIZE + branch];
             }
-            v->terminal = true;
-            v->patternIdx = i;
-            terminalNodes++;
+            output[v] |= uint64_t(1) << i;
         }
     }
 
     void buildAuto() {
-        node* rootLink = new node();
-        root->link = rootLink;
-        root->parent = rootLink;
-        for (int i = 0; i < ALPH_SIZE; ++i) {
-            rootLink->go[i] = root;
-        }
-        std::queue<node*> q;
-        q.push(root);
-        nodes.push_back(root);
+        std::queue<int> q;
+        q.push(0);
         while (!q.empty()) {
-            node* v = q.front();
+            int v = q.front();
             q.pop();
+            output[v] |= output[link[v]];
             for (int i = 0; i < ALPH_SIZE; ++i) {
-                if (v->go[i] != nullptr) {
-                    q.push(v->go[i]);
-                    nodes.push_back(v->go[i]);
-                }
-            }
-            if (v != root) {
-                v->link = v->parent->link->go[v->parentIdx];
-            }
-            for (int i = 0; i < ALPH_SIZE; ++i) {
-                if (v->go[i] == nullptr) {
-                    v->go[i] = v->link->go[i];
+                uint16_t& next = go[v * ALPH_SIZE + i];
+                if (next != 0) {
+                    link[next] = v == 0 ? 0 : go[link[v] * ALPH_SIZE + i];
+                    q.push(next);
+                } else {
+                    next = v == 0 ? 0 : go[link[v] * ALPH_SIZE + i];
                 }
             }
         }
-        std::reverse(nodes.begin(), nodes.end());
     }
 
-    void propagate() {
-        for (auto v : nodes) {
-            v->link->counter += v->counter;
+    void buildWindows(int length) {
+        uint32_t total = 1;
+        for (int i = 0; i < length; ++i) {
+            total *= ALPH_SIZE;
         }
-    }
-
-    void clear() {
-        for (auto v : nodes) {
-            v->counter = 0;
+        windowClass.resize(total);
+        std::map<std::pair<uint64_t, uint64_t>, uint16_t> ids;
+        fillWindows(length, 0, 0, 1, hits(), ids);
+        if (classes.size() > UINT16_MAX) {
+            windowClass.clear();
+            classes.clear();
         }
     }
 
-    void deleteTrie() {
-        delete root->link;
-        for (auto v : nodes) {
-            delete v;
+    // Walks all windows digit by digit, sharing automaton prefixes between them.
+    void fillWindows(int left, int state, uint32_t code, uint32_t digit, hits h,
+                     std::map<std::pair<uint64_t, uint64_t>, uint16_t>& ids) {
+        if (left == 0) {
+            auto it = ids.find({h.once, h.more});
+            if (it == ids.end()) {
+                it = ids.insert({{h.once, h.more}, uint16_t(classes.size())}).first;
+                classes.push_back(h);
+            }
+            windowClass[code] = it->second;
+            return;
+        }
+        for (int c = 0; c < ALPH_SIZE; ++c) {
+            int next = go[state * ALPH_SIZE + c];
+            hits g = h;
+            g.more |= g.once & output[next];
+            g.once |= output[next];
+            fillWindows(left - 1, next, code + c * digit, digit * ALPH_SIZE, g, ids);
         }
     }
 };
 
+// Board size for practically unbounded play: the first move goes to the center,
+// 16384 cells from every edge. Coordinates stay within the 16 bits the
+// transposition table stores.
+const int UNBOUNDED = 1 << 15;
+
 class Game {
 public:
     Game() = default;
+    // Only a window of the board around the stones is materialized; it starts at
+    // initialWindow cells and grows as stones approach its edges, so memory and
+    // copies scale with the occupied area rather than with boardSize.
+    // toWin must be in [MIN_WIN, MAX_WIN].
     Game(int boardSize, int toWin): boardSize(boardSize), toWin(toWin) {
-        board = std::vector<std::vector<int>>(boardSize, std::vector<int>(boardSize, 0));
-        automatum = new Automatum(patterns);
-        results.resize(automatum->getTerminalNodes());
+        assert(toWin >= MIN_WIN && toWin <= MAX_WIN);
+        for (const auto& shape : patternShapes(toWin)) {
+            for (int player = 1; player <= 2; ++player) {
+                pattern p;
+                p.data.assign(shape.cells, shape.cells + shape.length);
+                for (int& c : p.data) {
+                    c *= player;
+                }
+                int sign = player == 1 ? 1 : -1;
+                p.once = sign * group[shape.group].first;
+                p.more = sign * group[shape.group].second;
+                p.group = shape.group;
+                patterns.push_back(p);
+            }
+        }
+        int size = std::min(boardSize, initialWindow);
+        board = Board(size, std::max(toWin, maxDistToMove), (boardSize - size) / 2, (boardSize - size) / 2);
+        automatum = std::make_shared<const Automatum>(patterns, 2 * toWin + 1);
+        table = std::make_shared<TranspositionTable>();
+        std::vector<std::vector<int>> cells;
+        for (const auto& p : patterns) {
+            cells.push_back(p.data);
+        }
+        scanner = PatternScanner(cells);
+        allocateWindow();
+        moveBuffers.resize(maxDepth + 1);
+        threatCells.resize(maxDepth + 1);
+        killers.assign(maxDepth + 1, {{{-1, -1}, {-1, -1}}});
+        centerDigit = 1;
+        for (int k = 0; k < toWin; ++k) {
+            centerDigit *= ALPH_SIZE;
+        }
+        for (int i = 0; i < (int)patterns.size(); ++i) {
+            uint8_t player = std::count(patterns[i].data.begin(), patterns[i].data.end(), CROSS) > 0 ? CROSS : NOUGHT;
+            groupMask[patterns[i].group][player] |= uint64_t(1) << i;
+        }
+        rng.seed(std::random_device()());
         moveX = true;
         lastX = -1; lastY = -1;
-        lastMinX = -1; lastMinY = -1; lastMaxX = -1; lastMaxY = -1;
         minX = boardSize; minY = boardSize;
         maxX = -1; maxY = -1;
-        positionEvaluation = 0; prevPositionEvaluation = 0;
+        positionEvaluation = 0;
+        undoStack.reserve(undoReserve);
+        updateConfigKey();
     }
     
     bool isMoveX() { 
@@ -168,21 +305,101 @@ public:
         moveX = mv; 
     }
     
-    std::vector<std::vector<int>> getBoard() { 
+    // The materialized window of the board; cells outside it are empty.
+    const Board& getBoard() const { 
         return board; 
     }
 
+    int size() const {
+        return boardSize;
+    }
+
+    // Cell anywhere on the board, WALL off it.
+    uint8_t at(int x, int y) const {
+        if (x < 0 || y < 0 || x >= boardSize || y >= boardSize) {
+            return WALL;
+        }
+        return board.inside(x, y) ? board.at(x, y) : uint8_t(EMPTY);
+    }
+
+    bool isFree(int x, int y) const {
+        return at(x, y) == EMPTY;
+    }
+
+    // Zobrist key of the stones and the side to move.
+    uint64_t getHash() const {
+        return moveX ? hash : hash ^ SIDE_KEY;
+    }
+
+    // Transposition table shared by this game and its copies.
+    TranspositionTable& getTable() {
+        return *table;
+    }
+
+    void setHashSize(size_t megabytes) {
+        table->resize(megabytes);
+    }
+
+    // Evaluation weights of the pattern groups, see weights.h.
+    const std::vector<std::pair<int, int>>& getWeights() const {
+        return group;
+    }
+
+    // Replaces the evaluation weights; the five-in-a-row group stays a win. Only
+    // before the first move, as the running evaluation is not recomputed.
+    bool setWeights(const std::vector<std::pair<int, int>>& weights) {
+        if (weights.size() != WEIGHT_GROUPS || !undoStack.empty()) {
+            return false;
+        }
+        for (int g = 1; g < WEIGHT_GROUPS; ++g) {
+            group[g] = weights[g];
+        }
+        for (auto& p : patterns) {
+            int sign = std::count(p.data.begin(), p.data.end(), CROSS) > 0 ? 1 : -1;
+            p.once = sign * group[p.group].first;
+            p.more = sign * group[p.group].second;
+        }
+        automatum = std::make_shared<const Automatum>(patterns, 2 * toWin + 1);
+        updateConfigKey();
+        return true;
+    }
+
+    // Reads a weights file over the current weights and applies it.
+    bool loadWeights(const std::string& path) {
+        std::vector<std::pair<int, int>> weights = group;
+        return readWeights(path, weights) && setWeights(weights);
+    }
+
+    // Opening book consulted before searching, shared by copies; nullptr for none.
+    void setBook(std::shared_ptr<const OpeningBook> openingBook) {
+        book = openingBook;
+    }
+
+    // Persistent analysis store consulted and fed by the search, shared by copies;
+    // nullptr for none. Entries are keyed by the board size, win length and weights
+    // too, so games of any settings can share one store.
+    void setAnalysis(std::shared_ptr<AnalysisStore> store) {
+        analysis = store;
+    }
+
+    // Seeds the tie-breaking randomness, e.g. for reproducible games.
+    void setSeed(uint32_t seed) {
+        rng.seed(seed);
+    }
+
     void move(int x, int y) {
-        if (board[x][y] == 0) {
-            prevPositionEvaluation = positionEvaluation;
-            positionEvaluation -= evaluateMove(x, y);
-            board[x][y] = moveX ? 1 : 2;
-            positionEvaluation += evaluateMove(x, y);
-            moveX = !moveX;
-            lastX = x;
-            lastY = y;
-            updateBounds();
+        if (isFree(x, y)) {
+            makeMove(x, y);
+        }
+    }
+
+    // Takes back the last move; false if there is none.
+    bool undo() {
+        if (undoStack.empty()) {
+            return false;
         }
+        unmakeMove();
+        return true;
     }
 
     void getLastMove(int& x, int& y) {
@@ -190,233 +407,1069 @@ public:
         y = lastY;
     }
 
+    // True if the last move made toWin in a row.
     bool checkWin() {
-        if (lastX == -1) {
-            return false;
-        }
-        automatum->processText(board, lastX - toWin, lastY, lastX + toWin, lastY, 1, 0, true, true);
-        automatum->processText(board, lastX, lastY - toWin, lastX, lastY + toWin, 0, 1, true, true);
-        automatum->processText(board, lastX - toWin, lastY - toWin, lastX + toWin, lastY + toWin, 1, 1, true, true);
-        automatum->processText(board, lastX - toWin, lastY + toWin, lastX + toWin, lastY - toWin, 1, -1, true, false);
-        automatum->getResults(results);
-        return results[0] > 0 || results[1] > 0;
+        TTT_PHASE(stats, PHASE_CHECK_WIN);
+        return lastMoveWins();
+    }
+
+    // True if no cell is left to play.
+    bool isFull() const {
+        // with stones, no empty cell near them means no empty cell at all
+        return candidates.empty() && !isFree(boardSize / 2, boardSize / 2);
     }
 
-    void machineMove() {
-        Game machine(*this);
-        if (!moveIfCanWin(machine)) {
-            machine.setMoveX(!machine.isMoveX());
-            if (!moveIfCanWin(machine)) {
-                machine.setMoveX(!machine.isMoveX());
-                std::pair<int, int> nextMove;
-                int score, alpha = -inf, beta = inf;
-                score = getBestScore(machine, 1, nextMove, alpha, beta);
-                std::cout << "Best score: " << score << std::endl;
-                move(nextMove.first, nextMove.second);
+    // Best move for the side to move, without playing it. The search makes and
+    // unmakes moves on this game and leaves the position as it found it; only
+    // move-ordering statistics, the random state and the shared transposition
+    // table change. To keep using the game meanwhile, think on a copy. The move is
+    // {-1, -1} when the board is full.
+    searchResult think(const searchLimits& limits = searchLimits()) {
+        searchResult result;
+        if (candidates.empty()) {
+            // no stones yet: open in the center; with stones, no empty cell near
+            // them means no empty cell at all
+            if (isFree(boardSize / 2, boardSize / 2)) {
+                result.move = {boardSize / 2, boardSize / 2};
             }
+            return result;
         }
+        TTT_COUNT(stats = searchStats(); uint64_t start = nowMicros();)
+        result = decide(*this, limits);
+        TTT_COUNT(stats.span("think", 0, start); result.stats = std::move(stats);)
+        return result;
+    }
+
+    searchResult machineMove(const searchLimits& limits = searchLimits()) {
+        searchResult result = think(limits);
+        move(result.move.first, result.move.second);
+        return result;
     }
 
 private:
-    const int maxDistToMove = 2, maxDistToCheck = 3;
-    const int maxDepth = 4;
-    const int inf = 100000;
-    const int randomNoise = 5;
-    const std::vector<std::pair<int, int>> group = {{inf, inf}, {1000, 1300}, {80, 180}, {60, 220}, {10, 25}}; // TODO
-    const std::vector<pattern> patterns = {
-        {{1, 1, 1, 1, 1}, group[0].first, group[0].second}, {{2, 2, 2, 2, 2}, -group[0].first, -group[0].second}, // 0-1
-
-        {{0, 1, 1, 1, 1, 0}, group[1].first, group[1].second}, {{0, 2, 2, 2, 2, 0}, -group[1].first, -group[1].second}, // 2-3
-
-        {{1, 1, 1, 1, 0}, group[2].first, group[2].second}, {{2, 2, 2, 2, 0}, -group[2].first, -group[2].second}, // 4-13
-        {{1, 1, 1, 0, 1}, group[2].first, group[2].second}, {{2, 2, 2, 0, 2}, -group[2].first, -group[2].second},
-        {{1, 1, 0, 1, 1}, group[2].first, group[2].second}, {{2, 2, 0, 2, 2}, -group[2].first, -group[2].second},
-        {{1, 0, 1, 1, 1}, group[2].first, group[2].second}, {{2, 0, 2, 2, 2}, -group[2].first, -group[2].second},
-        {{0, 1, 1, 1, 1}, group[2].first, group[2].second}, {{0, 2, 2, 2, 2}, -group[2].first, -group[2].second},
-
-        {{0, 1, 1, 1, 0, 0}, group[3].first, group[3].second}, {{0, 2, 2, 2, 0, 0}, -group[3].first, -group[3].second}, // 14-21
-        {{0, 0, 1, 1, 1, 0}, group[3].first, group[3].second}, {{0, 0, 2, 2, 2, 0}, -group[3].first, -group[3].second},
-        {{0, 1, 0, 1, 1, 0}, group[3].first, group[3].second}, {{0, 2, 0, 2, 2, 0}, -group[3].first, -group[3].second},
-        {{0, 1, 1, 0, 1, 0}, group[3].first, group[3].second}, {{0, 2, 2, 0, 2, 0}, -group[3].first, -group[3].second},
-
-        {{0, 1, 1, 0, 0, 0}, group[4].first, group[4].second}, {{0, 2, 2, 0, 0, 0}, -group[4].first, -group[4].second}, // 22-33
-        {{0, 0, 1, 1, 0, 0}, group[4].first, group[4].second}, {{0, 0, 2, 2, 0, 0}, -group[4].first, -group[4].second},
-        {{0, 1, 0, 1, 0, 0}, group[4].first, group[4].second}, {{0, 2, 0, 2, 0, 0}, -group[4].first, -group[4].second},
-        {{0, 1, 0, 0, 1, 0}, group[4].first, group[4].second}, {{0, 2, 0, 0, 2, 0}, -group[4].first, -group[4].second},
-        {{0, 0, 1, 0, 1, 0}, group[4].first, group[4].second}, {{0, 0, 2, 0, 2, 0}, -group[4].first, -group[4].second},
-        {{0, 0, 0, 1, 1, 0}, group[4].first, group[4].second}, {{0, 0, 0, 2, 2, 0}, -group[4].first, -group[4].second}
-    };
+    friend class Bench; // bench.cpp times the private hot paths
+    friend class Tuner; // tune.cpp extracts evaluation features
 
-    int positionEvaluation, prevPositionEvaluation;
+    // compile-time constants, so that the loops bounded by them are unrolled
+    static constexpr int maxDistToMove = 2, maxDistToCheck = 3;
+    static constexpr int maxDepth = 64;
+    static_assert(searchStats::MAX_PLY > maxDepth, "node counts are kept for every depth up to maxDepth");
+    static constexpr int initialWindow = 32;
+    static constexpr int undoReserve = 256; // moves; grows past that only with the game itself
+    static constexpr int checkEvery = 16;     // nodes between clock reads, well under a millisecond
+    static constexpr int publishEvery = 1024; // nodes between updates of the shared node count
+    static constexpr int checkThreatsEvery = 64; // solver nodes are much slower
+    static constexpr int inf = 100000;
+    static constexpr int randomNoise = 5;
+    // (once, more) per pattern group, see weights.h; replaced by setWeights
+    std::vector<std::pair<int, int>> group = {{inf, inf}, {1000, 1300}, {80, 180}, {60, 220}, {10, 25}};
+    // built for the win length from patterns.h, X's and O's shape in turn
+    std::vector<pattern> patterns;
+
+    int positionEvaluation;
 
     int boardSize, toWin;
+    // state of the running search
+    int searchDepth = 0, searchId = 0;
+    uint64_t nodes = 0, nodeLimit = 0;
+    std::chrono::steady_clock::time_point deadline;
+    bool timed = false, stopped = false, pruneThreats = false;
+    uint64_t threatNodes = 0, threatBudget = 0;
+    std::chrono::steady_clock::time_point threatDeadline;
+    std::vector<std::pair<int, int>> pvLine;
+    std::pair<int, int> rootMove; // best root move of the running iteration so far
+    searchShared* shared = nullptr;
+    const std::atomic<bool>* cancel = nullptr;
     int lastX, lastY;
-    int lastMinX, lastMinY, lastMaxX, lastMaxY;
     int minX, minY, maxX, maxY;
     bool moveX;
 
-    std::vector<std::vector<int>> board;
-    std::vector<int> results;
-    Automatum* automatum = nullptr;
+    Board board;
+    // windows[d * stride^2 + idx]: base-3 code of the 2 * toWin + 1 cells centered at
+    // idx along direction d, kept up to date by place().
+    std::vector<uint32_t> windows;
+    // Empty cells with a stone within maxDistToMove: neighbours counts the stones
+    // around every cell and candidates is a swap-remove set of cell indices
+    // (candidateSlot[idx] is the position in it or -1). Both are kept by place().
+    std::vector<uint8_t> neighbours;
+    std::vector<int> candidates, candidateSlot;
+    // runs[(idx * 2 + player - 1) * 8 + d * 2 + side]: the player's stones in an
+    // unbroken line from the cell's neighbour along direction d, backwards (side 0)
+    // or forwards (side 1), whatever the cell itself holds; saturates at 255. Kept
+    // for every cell by place(), so whether a move makes a row is a lookup.
+    std::vector<uint8_t> runs;
+    std::vector<std::vector<moveWithEval>> moveBuffers; // one per search depth, eval is the ordering key
+    std::vector<std::vector<threatCell>> threatCells;   // one per threat solver depth
+    std::vector<std::array<std::pair<int, int>, 2>> killers; // per depth
+    std::vector<int> history; // [side * stride^2 + idx], bumped on cutoffs
+    uint64_t groupMask[5][3] = {}; // [group][player]: patterns of the group made by the player
+    uint32_t centerDigit;          // weight of the center cell in a window code
+    std::mt19937 rng;
+    PatternScanner scanner;
+#ifdef TTT_STATS
+    searchStats stats; // counters of the search running on this game
+#endif
+    uint64_t hash = 0; // stones only, see getHash()
+    std::shared_ptr<TranspositionTable> table;
+    std::shared_ptr<const OpeningBook> book;
+    std::shared_ptr<AnalysisStore> analysis;
+    uint64_t configKey = 0; // mixed into analysis store keys, see updateConfigKey()
+    ttCounters ttCounts; // this search's probes, added to the table's totals at the end
+    std::vector<int> patternCounts;
+    std::shared_ptr<const Automatum> automatum; // immutable, shared by copies
+
+    // Everything a move changes, for unmakeMove. The candidate set is restored from
+    // the journal of its operations, which keeps its order too, unless the window
+    // has been rebuilt since (epoch changed).
+    struct undoRecord {
+        int lastX, lastY;
+        int minX, minY, maxX, maxY;
+        int evaluation;
+        uint64_t hash;
+        int journalMark, epoch;
+    };
+    std::vector<undoRecord> undoStack;
+    // Candidate set operations: idx for an add, (slot, ~idx) for a removal.
+    std::vector<int> journal;
+    int epoch = 0; // window rebuilds
+
+    void makeMove(int x, int y) {
+        undoStack.push_back({lastX, lastY, minX, minY, maxX, maxY, positionEvaluation, hash, (int)journal.size(), epoch});
+        positionEvaluation -= evaluateMove(x, y);
+        place(x, y, moveX ? CROSS : NOUGHT);
+        positionEvaluation += evaluateMove(x, y);
+        moveX = !moveX;
+        lastX = x;
+        lastY = y;
+        minX = std::min(minX, x); minY = std::min(minY, y);
+        maxX = std::max(maxX, x); maxY = std::max(maxY, y);
+    }
 
-    void revert(int x, int y, int miX, int miY, int maX, int maY, int prevPos) {
-        if (lastX != -1 && lastY != -1) {
-            board[lastX][lastY] = 0;
+    void unmakeMove() {
+        const undoRecord& r = undoStack.back();
+        if (r.epoch == epoch) {
+            place(lastX, lastY, EMPTY, false);
+            rollback(r.journalMark);
+        } else {
+            place(lastX, lastY, EMPTY);
+            journal.clear();
         }
-        revertBounds(miX, miY, maX, maY);
-        lastX = x; lastY = y;
-        positionEvaluation = prevPos;
+        lastX = r.lastX; lastY = r.lastY;
+        minX = r.minX; minY = r.minY; maxX = r.maxX; maxY = r.maxY;
+        positionEvaluation = r.evaluation;
+        hash = r.hash;
         moveX = !moveX;
+        undoStack.pop_back();
     }
 
-    void updateBounds() {
-        lastMinX = minX; lastMinY = minY;
-        lastMaxX = maxX; lastMaxY = maxY;
-        minX = std::min(minX, lastX); minY = std::min(minY, lastY);
-        maxX = std::max(maxX, lastX); maxY = std::max(maxY, lastY);
+    // Undoes candidate set operations back to the given journal length.
+    void rollback(int mark) {
+        while ((int)journal.size() > mark) {
+            int op = journal.back();
+            journal.pop_back();
+            if (op >= 0) {
+                // added last, so it is at the back
+                candidates.pop_back();
+                candidateSlot[op] = -1;
+                continue;
+            }
+            int idx = ~op, slot = journal.back();
+            journal.pop_back();
+            if (slot == (int)candidates.size()) {
+                candidates.push_back(idx);
+            } else {
+                int moved = candidates[slot];
+                candidateSlot[moved] = candidates.size();
+                candidates.push_back(moved);
+                candidates[slot] = idx;
+            }
+            candidateSlot[idx] = slot;
+        }
     }
 
-    void revertBounds(int miX, int miY, int maX, int maY) {
-        minX = lastMinX; maxX = lastMaxX;
-        minY = lastMinY; maxY = lastMaxY;
-        lastMinX = miX; lastMinY = miY; lastMaxX = maX; lastMaxY = maY;
+    // Room for a search of maxDepth plies without reallocating; copies of a game
+    // get only as much capacity as they hold.
+    void reserveSearch() {
+        int perMove = 2 * (2 * maxDistToMove + 1) * (2 * maxDistToMove + 1);
+        undoStack.reserve(undoStack.size() + maxDepth + 1);
+        journal.reserve(journal.size() + (maxDepth + 2) * perMove);
     }
 
-    int evaluateMove(int x, int y) {
-        automatum->processText(board, x - toWin, y, x + toWin, y, 1, 0, true, true);
-        automatum->processText(board, x, y - toWin, x, y + toWin, 0, 1, true, true);
-        automatum->processText(board, x - toWin, y - toWin, x + toWin, y + toWin, 1, 1, true, true);
-        automatum->processText(board, x - toWin, y + toWin, x + toWin, y - toWin, 1, -1, true, false);
-        automatum->getResults(results);
+    // Sets a cell, keeping the hash, window codes, neighbour counts and, unless
+    // told otherwise, the candidate set up to date.
+    void place(int x, int y, uint8_t value, bool updateCandidates = true) {
+        if (value != EMPTY && !hasRoom(x, y)) {
+            growWindow(x, y);
+        }
+        int idx = board.index(x, y);
+        uint8_t old = board[idx];
+        uint32_t delta = uint32_t(value) - uint32_t(old);
+        if (old != EMPTY) {
+            hash ^= zobristKey(x, y, old);
+        }
+        if (value != EMPTY) {
+            hash ^= zobristKey(x, y, value);
+        }
+        board.set(x, y, value);
+        if (old == EMPTY && value != EMPTY) {
+            updateRuns(idx, value, 1);
+        } else if (old != EMPTY && value == EMPTY) {
+            updateRuns(idx, old, 0);
+        }
+        switch (toWin) {
+        case 3:
+            updateWindows<3>(idx, delta);
+            break;
+        case 4:
+            updateWindows<4>(idx, delta);
+            break;
+        default:
+            updateWindows<5>(idx, delta);
+        }
+        if (old == EMPTY && value != EMPTY) {
+            updateNeighbours(idx, 1, updateCandidates);
+            if (updateCandidates) {
+                removeCandidate(idx);
+            }
+        } else if (old != EMPTY && value == EMPTY) {
+            updateNeighbours(idx, -1, updateCandidates);
+            if (updateCandidates && neighbours[idx] > 0) {
+                addCandidate(idx);
+            }
+        }
+    }
 
-        int answer = 0;
-        for (int i = 0; i < patterns.size(); ++i) {
-            if (results[i] != 0) {
-                answer += results[i] > 1 ? patterns[i].more : patterns[i].once;
+    // Adds delta, the change of the cell at idx, to the codes of the windows that
+    // contain it; W is toWin, fixed so that the loops unroll.
+    template <int W>
+    void updateWindows(int idx, uint32_t delta) {
+        int area = board.stride() * board.stride();
+        for (int d = 0; d < DIRECTIONS; ++d) {
+            uint32_t* w = windows.data() + d * area + idx;
+            int offset = board.offset(d);
+            uint32_t digit = delta;
+            for (int k = -W; k <= W; ++k, digit *= ALPH_SIZE) {
+                w[-k * offset] += digit;
             }
         }
+    }
 
-        return answer;
+    uint8_t* runsAt(int idx, uint8_t player) {
+        return runs.data() + (idx * 2 + player - 1) * 8;
     }
 
-    int evaluatePosition() {
-        for (int y = minY - maxDistToCheck; y <= maxY + maxDistToCheck; ++y) {
+    // A stone of the player was put on idx (stone 1) or taken off it (stone 0):
+    // the cells along each line up to the first one past the run through idx
+    // count their runs again. A run ends at a cell of another kind, at worst the
+    // WALL padding, so no write leaves the window.
+    void updateRuns(int idx, uint8_t player, int stone) {
+        const uint8_t* own = runsAt(idx, player);
+        for (int d = 0; d < DIRECTIONS; ++d) {
+            int offset = board.offset(d), back = own[2 * d], ahead = own[2 * d + 1];
+            for (int k = 1; k <= ahead + 1; ++k) {
+                runsAt(idx + k * offset, player)[2 * d] = std::min(255, stone * (back + 1) + k - 1);
+            }
+            for (int k = 1; k <= back + 1; ++k) {
+                runsAt(idx - k * offset, player)[2 * d + 1] = std::min(255, stone * (ahead + 1) + k - 1);
+            }
+        }
+    }
+
+    bool lastMoveWins() {
+        return lastX != -1 && makesRow(board.index(lastX, lastY), board.at(lastX, lastY));
+    }
+
+    // True if a stone of the player on idx is in a row of toWin or more.
+    bool makesRow(int idx, uint8_t player) {
+        const uint8_t* r = runsAt(idx, player);
+        for (int d = 0; d < DIRECTIONS; ++d) {
+            if (r[2 * d] + r[2 * d + 1] + 1 >= toWin) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void updateNeighbours(int idx, int delta, bool updateCandidates) {
+        int first = idx - maxDistToMove * (board.stride() + 1);
+        for (int x = 0; x <= 2 * maxDistToMove; ++x, first += board.stride()) {
+            for (int c = first; c <= first + 2 * maxDistToMove; ++c) {
+                neighbours[c] += delta;
+                if (!updateCandidates) {
+                    continue;
+                }
+                if (delta > 0 && neighbours[c] == 1 && board[c] == EMPTY) {
+                    addCandidate(c);
+                } else if (delta < 0 && neighbours[c] == 0) {
+                    removeCandidate(c);
+                }
+            }
+        }
+    }
+
+    void addCandidate(int idx) {
+        if (candidateSlot[idx] == -1) {
+            candidateSlot[idx] = candidates.size();
+            candidates.push_back(idx);
+            journal.push_back(idx);
+        }
+    }
+
+    void removeCandidate(int idx) {
+        int slot = candidateSlot[idx];
+        if (slot != -1) {
+            journal.push_back(slot);
+            journal.push_back(~idx);
+            candidates[slot] = candidates.back();
+            candidateSlot[candidates[slot]] = slot;
+            candidates.pop_back();
+            candidateSlot[idx] = -1;
+        }
+    }
+
+    // Sizes everything indexed by cell to the current window.
+    void allocateWindow() {
+        int area = board.stride() * board.stride();
+        windows.assign(DIRECTIONS * area, 0);
+        neighbours.assign(area, 0);
+        runs.assign(16 * area, 0);
+        candidateSlot.assign(area, -1);
+        candidates.clear();
+        history.assign(2 * area, 0);
+        journal.clear();
+        ++epoch;
+    }
+
+    // Move evaluation reads up to maxDistToMove + toWin cells away from a stone;
+    // those cells must be in the window unless the board itself ends first.
+    bool hasRoom(int x, int y) const {
+        int m = maxDistToMove + toWin, n = board.size();
+        int fx = board.firstX(), fy = board.firstY();
+        return (x - m >= fx || fx == 0) && (x + m < fx + n || fx + n == boardSize)
+            && (y - m >= fy || fy == 0) && (y + m < fy + n || fy + n == boardSize);
+    }
+
+    // Re-centers the window on the stones and (x, y), at least doubling it, and
+    // rebuilds the per-cell state. Coordinates, and so hashes, killers and table
+    // moves, are unaffected; history scores are dropped.
+    void growWindow(int x, int y) {
+        std::vector<std::pair<int, int>> stones;
+        std::vector<uint8_t> values;
+        int loX = x, hiX = x, loY = y, hiY = y;
+        for (int i = board.firstX(); i < board.firstX() + board.size(); ++i) {
+            for (int j = board.firstY(); j < board.firstY() + board.size(); ++j) {
+                if (board.at(i, j) != EMPTY) {
+                    stones.push_back({i, j});
+                    values.push_back(board.at(i, j));
+                    loX = std::min(loX, i); hiX = std::max(hiX, i);
+                    loY = std::min(loY, j); hiY = std::max(hiY, j);
+                }
+            }
+        }
+        int m = maxDistToMove + toWin;
+        int extent = std::max(hiX - loX, hiY - loY) + 2 * m + 3;
+        int size = std::min(boardSize, std::max(2 * board.size(), extent));
+        int fx = std::max(0, std::min(boardSize - size, (loX + hiX) / 2 - size / 2));
+        int fy = std::max(0, std::min(boardSize - size, (loY + hiY) / 2 - size / 2));
+        board = Board(size, board.getPadding(), fx, fy);
+        allocateWindow();
+        uint64_t stonesHash = hash;
+        for (size_t i = 0; i < stones.size(); ++i) {
+            place(stones[i].first, stones[i].second, values[i]);
+        }
+        journal.clear();
+        hash = stonesHash;
+    }
+
+    // Windows of cells closer than toWin to the edge would include WALL cells.
+    bool isInterior(int x, int y) {
+        return board.inside(x - toWin, y - toWin) && board.inside(x + toWin, y + toWin);
+    }
+
+    int evaluateMove(int x, int y) {
+        TTT_PHASE(stats, PHASE_EVALUATE_MOVE);
+        return automatum->score(moveHits(x, y));
+    }
+
+    // Patterns in the lines through (x, y), up to toWin cells away.
+    hits moveHits(int x, int y) {
+        hits h;
+        if (automatum->hasWindows() && isInterior(x, y)) {
+            TTT_COUNT(++stats.windowLookups;)
+            int idx = board.index(x, y), area = board.stride() * board.stride();
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                h.add(automatum->window(windows[d * area + idx]));
+            }
+        } else {
+            TTT_COUNT(++stats.lineScans;)
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                automatum->processText(board.line(x, y, d, -toWin, toWin), h);
+            }
+        }
+        return h;
+    }
+
+    // Automatum scan of every line through the rectangle, each line clipped to it.
+    hits scanBox(int loX, int loY, int hiX, int hiY) {
+        hits h;
+        for (int y = loY; y <= hiY; ++y) {
             // columns ↓
-            automatum->processText(board, 
-                                  minX - maxDistToCheck, y, 
-                                  maxX + maxDistToCheck, y, 
-                                  1, 0, true, true);
+            automatum->processText(board.line(loX, y, 0, 0, hiX - loX), h);
             // upper diagonals to the right ↘
-            automatum->processText(board, 
-                                  minX - maxDistToCheck, y, 
-                                  maxX + maxDistToCheck, maxY + maxDistToCheck, 
-                                  1, 1, true, true);
+            automatum->processText(board.line(loX, y, 2, 0, std::min(hiX - loX, hiY - y)), h);
             // upper diagonals to the left ↙
-            automatum->processText(board, 
-                                  minX - maxDistToCheck, y, 
-                                  maxX + maxDistToCheck, minY - maxDistToCheck, 
-                                  1, -1, true, false);
+            automatum->processText(board.line(loX, y, 3, 0, std::min(hiX - loX, y - loY)), h);
         }
-        for (int x = minX - maxDistToCheck; x <= maxX + maxDistToCheck; ++x) {
+        for (int x = loX; x <= hiX; ++x) {
             // rows →
-            automatum->processText(board, 
-                                  x, minY - maxDistToCheck, 
-                                  x, maxY + maxDistToCheck, 
-                                  0, 1, true, true);
+            automatum->processText(board.line(x, loY, 1, 0, hiY - loY), h);
+            if (x == loX) {
+                continue; // corner diagonals are already scanned above
+            }
             // lower diagonals to the right ↘
-            automatum->processText(board, 
-                                  x, minY - maxDistToCheck, 
-                                  maxX + maxDistToCheck, maxY + maxDistToCheck, 
-                                  1, 1, true, true);
+            automatum->processText(board.line(x, loY, 2, 0, std::min(hiX - x, hiY - loY)), h);
             // lower diagonals to the left ↙
-            automatum->processText(board, 
-                                  x, maxY + maxDistToCheck, 
-                                  maxX + maxDistToCheck, minY - maxDistToCheck, 
-                                  1, -1, true, false);
+            automatum->processText(board.line(x, hiY, 3, 0, std::min(hiX - x, hiY - loY)), h);
         }
-        automatum->getResults(results);
+        return h;
+    }
+
+    int evaluatePosition() {
+        TTT_PHASE(stats, PHASE_EVALUATE_POSITION);
+        int loX = minX - maxDistToCheck, hiX = maxX + maxDistToCheck;
+        int loY = minY - maxDistToCheck, hiY = maxY + maxDistToCheck;
+        scanner.count(board, loX, loY, hiX, hiY, patternCounts);
+        hits h;
+        for (int i = 0; i < (int)patternCounts.size(); ++i) {
+            if (patternCounts[i] > 0) {
+                h.once |= uint64_t(1) << i;
+            }
+            if (patternCounts[i] > 1) {
+                h.more |= uint64_t(1) << i;
+            }
+        }
+#ifdef TTT_VERIFY
+        hits slow = scanBox(loX, loY, hiX, hiY);
+        assert(slow.once == h.once && slow.more == h.more);
+#endif
         int answer = 0;
         int score;
-        for (int i = 0; i < patterns.size(); ++i) {
-            if (results[i] == 0) {
-                continue;
-            }
-            score = results[i] > 1 ? patterns[i].more : patterns[i].once;
+        for (uint64_t m = h.once; m != 0; m &= m - 1) {
+            score = automatum->weight(h, __builtin_ctzll(m));
             if (score == inf || score == -inf) {
                 return score;
             } else {
                 answer += score;
             }
         }
-        std::random_device rd;
-        std::mt19937 gen(rd());
         std::uniform_int_distribution<int> distr(-randomNoise, randomNoise);
-        return answer + distr(gen);
+        return answer + distr(rng);
+    }
+
+    void getAvailableMoves(std::vector<moveWithEval>& moves) {
+        TTT_PHASE(stats, PHASE_MOVE_GEN);
+        moves.resize(candidates.size());
+        for (int i = 0; i < (int)candidates.size(); ++i) {
+            board.coords(candidates[i], moves[i].move.first, moves[i].move.second);
+            moves[i].eval = 0;
+        }
+    }
+
+    // Reusable move list for the given search depth.
+    std::vector<moveWithEval>& moveBuffer(int depth) {
+        return moveBuffers[depth];
     }
 
-    bool isClose(int centerX, int centerY) {
-        for (int x = centerX - maxDistToMove; x <= centerX + maxDistToMove; ++x) {
-            for (int y = centerY - maxDistToMove; y <= centerY + maxDistToMove; ++y) {
-                if (board[x][y] != 0) {
-                    return true;
+    // Move classes in search order; a move gets the highest class that applies.
+    enum moveTier {
+        TIER_QUIET = 0,
+        TIER_KILLER = 1,
+        TIER_BLOCK_THREE = 2,    // stops an open three of the opponent
+        TIER_ATTACK = 3,         // makes a four or an open three, or stops a four
+        TIER_OPEN_FOUR = 4,
+        TIER_BLOCK_FIVE = 5,
+        TIER_WIN = 6,
+        TIER_HASH = 7            // transposition table or principal variation move
+    };
+
+    // Patterns the player would newly make by playing on (x, y).
+    uint64_t createdPatterns(int x, int y, uint8_t player) {
+        hits before, after;
+        if (automatum->hasWindows() && isInterior(x, y)) {
+            int idx = board.index(x, y), area = board.stride() * board.stride();
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                uint32_t code = windows[d * area + idx];
+                before.add(automatum->window(code));
+                after.add(automatum->window(code + player * centerDigit));
+            }
+        } else {
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                automatum->processText(board.line(x, y, d, -toWin, toWin), before);
+            }
+            board.set(x, y, player);
+            for (int d = 0; d < DIRECTIONS; ++d) {
+                automatum->processText(board.line(x, y, d, -toWin, toWin), after);
+            }
+            board.set(x, y, EMPTY);
+        }
+        return (after.once & ~before.once) | (after.more & ~before.more);
+    }
+
+    int threatTier(int x, int y) {
+        uint8_t me = moveX ? CROSS : NOUGHT, opponent = moveX ? NOUGHT : CROSS;
+        uint64_t mine = createdPatterns(x, y, me), theirs = createdPatterns(x, y, opponent);
+        if (mine & groupMask[0][me]) {
+            return TIER_WIN;
+        } else if (theirs & groupMask[0][opponent]) {
+            return TIER_BLOCK_FIVE;
+        } else if (mine & groupMask[1][me]) {
+            return TIER_OPEN_FOUR;
+        } else if ((mine & (groupMask[2][me] | groupMask[3][me])) || (theirs & (groupMask[1][opponent] | groupMask[2][opponent]))) {
+            return TIER_ATTACK;
+        } else if (theirs & groupMask[3][opponent]) {
+            return TIER_BLOCK_THREE;
+        }
+        return TIER_QUIET;
+    }
+
+    // Sorts moves by tier, then history score, with random tie-breaking. With
+    // threat pruning, drops everything but wins and blocks if the opponent
+    // threatens five.
+    void orderMoves(std::vector<moveWithEval>& moves, int depth, std::pair<int, int> first, bool prune) {
+        TTT_PHASE(stats, PHASE_ORDER_MOVES);
+        int area = board.stride() * board.stride(), side = moveX ? 0 : 1;
+        bool forced = false;
+        for (auto& m : moves) {
+            m.eval = threatTier(m.move.first, m.move.second);
+            forced = forced || m.eval == TIER_BLOCK_FIVE;
+        }
+        if (prune && forced) {
+            moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const moveWithEval& m) {
+                return m.eval < TIER_BLOCK_FIVE;
+            }), moves.end());
+        }
+        for (auto& m : moves) {
+            int tier = m.eval;
+            if (m.move == first) {
+                tier = TIER_HASH;
+            } else if (tier < TIER_KILLER && (m.move == killers[depth][0] || m.move == killers[depth][1])) {
+                tier = TIER_KILLER;
+            }
+            int score = std::min(history[side * area + board.index(m.move.first, m.move.second)], (1 << 20) - 1);
+            m.eval = tier << 28 | score << 8 | (rng() & 255);
+        }
+        std::sort(moves.begin(), moves.end(), [](const moveWithEval& a, const moveWithEval& b) {
+            return a.eval > b.eval;
+        });
+    }
+
+    void recordCutoff(std::pair<int, int> move, int depth, int remaining) {
+        int area = board.stride() * board.stride(), side = moveX ? 0 : 1;
+        history[side * area + board.index(move.first, move.second)] += remaining * remaining;
+        if (killers[depth][0] != move) {
+            killers[depth][1] = killers[depth][0];
+            killers[depth][0] = move;
+        }
+    }
+
+    // The stages of think: immediate win, forced block, threat solver, search.
+    searchResult decide(Game &machine, const searchLimits& limits) {
+        // the time limit covers the whole move, the threat solver included
+        auto moveStart = std::chrono::steady_clock::now();
+        searchResult result;
+        if (machine.probeBook(result)) {
+            return result;
+        }
+        TTT_COUNT(uint64_t start = nowMicros();)
+        bool won = findWin(machine, result.move);
+        TTT_COUNT(machine.stats.span("findWin", 0, start);)
+        if (won) {
+            result.score = moveX ? inf : -inf;
+            return result;
+        }
+        machine.setMoveX(!machine.isMoveX());
+        TTT_COUNT(start = nowMicros();)
+        bool lost = findWin(machine, result.move);
+        TTT_COUNT(machine.stats.span("findBlock", 0, start);)
+        machine.setMoveX(!machine.isMoveX());
+        if (lost) {
+            return result; // block the opponent's five
+        }
+        searchResult threats;
+        if (limits.threatNodes > 0) {
+            TTT_COUNT(start = nowMicros();)
+            // a timed move gives the solver at most half of its time
+            auto solverDeadline = limits.milliseconds > 0
+                ? moveStart + std::chrono::milliseconds(limits.milliseconds) / 2
+                : std::chrono::steady_clock::time_point::max();
+            machine.cancel = limits.cancel;
+            bool forced = machine.solveThreats(limits.threatPlies, limits.threatNodes, threats, solverDeadline);
+            TTT_COUNT(machine.stats.span("solveThreats", 0, start);)
+            if (forced) {
+                return threats;
+            }
+        }
+        result = search(machine, limits, moveStart + std::chrono::milliseconds(limits.milliseconds));
+        result.threatNodes = threats.threatNodes;
+        result.threatSeconds = threats.threatSeconds;
+        return result;
+    }
+
+    // Book move of the position, if it has few enough stones and they are far
+    // enough from the edges for the book's edgeless positions to apply.
+    bool probeBook(searchResult& result) {
+        if (!book || book->toWin() != toWin || (int)undoStack.size() > book->maxStones() || undoStack.empty()) {
+            return false;
+        }
+        int margin = toWin;
+        if (minX < margin || minY < margin || maxX >= boardSize - margin || maxY >= boardSize - margin) {
+            return false;
+        }
+        std::vector<bookStone> stones;
+        for (int x = minX; x <= maxX; ++x) {
+            for (int y = minY; y <= maxY; ++y) {
+                if (board.at(x, y) != EMPTY) {
+                    stones.push_back({x, y, board.at(x, y)});
                 }
             }
         }
+        bookFrame frame;
+        const bookEntry* entry = book->find(bookKey(stones, moveX, frame));
+        if (entry == nullptr) {
+            return false;
+        }
+        int x, y;
+        frame.fromBook(entry->x, entry->y, x, y);
+        if (!isFree(x, y)) {
+            return false;
+        }
+        result.move = {x, y};
+        result.score = entry->score;
+        result.depth = entry->depth;
+        result.pv = {result.move};
+        return true;
+    }
+
+    // Search results depend on the board size, the win length and the weights as
+    // well as on the stones.
+    void updateConfigKey() {
+        configKey = zobristKey(boardSize, toWin, WALL);
+        for (int g = 1; g < WEIGHT_GROUPS; ++g) {
+            configKey ^= zobristKey(group[g].first, group[g].second, g) * (2 * g + 1);
+        }
+    }
+
+    // Finds a move completing a row of toWin for the side to move in machine.
+    bool findWin(Game &machine, std::pair<int, int>& win) {
+        TTT_PHASE(machine.stats, PHASE_FIND_WIN);
+        machine.reserveSearch();
+        std::vector<moveWithEval>& moves = machine.moveBuffer(0);
+        machine.getAvailableMoves(moves);
+        uint8_t player = machine.isMoveX() ? CROSS : NOUGHT;
+        for (const auto& m : moves) {
+            if (machine.makesRow(machine.board.index(m.move.first, m.move.second), player)) {
+                win = m.move;
+                return true;
+            }
+        }
         return false;
     }
 
-    std::vector<std::pair<int, int>> getAvailableMoves() {
-        std::vector<std::pair<int, int>> moves;
-        for (int x = minX - maxDistToMove; x <= maxX + maxDistToMove; ++x) {
-            for (int y = minY - maxDistToMove; y <= maxY + maxDistToMove; ++y) {
-                if (board[x][y] == 0 && isClose(x, y)) {
-                    moves.push_back({x, y});
+    // Threat-space solver. Looks for a forced win of the side to move made of fours
+    // only (VCF), then of fours and open threes (VCT): the attacker plays only
+    // threats and every defence must lose. Defences against a four are its block;
+    // against a three, every cell where the attacker would make a four, and the
+    // defender's counter-fours and counter-threes. Depth-first with iterative
+    // deepening on plies, within a node budget shared by both passes, an optional
+    // deadline and the move's cancel flag.
+    bool solveThreats(int plies, uint64_t budget, searchResult& result,
+                      std::chrono::steady_clock::time_point until = std::chrono::steady_clock::time_point::max()) {
+        TTT_PHASE(stats, PHASE_THREATS);
+        reserveSearch();
+        auto start = std::chrono::steady_clock::now();
+        threatNodes = 0;
+        threatBudget = budget;
+        threatDeadline = until;
+        bool found = false;
+        for (int pass = 0; pass < 2 && !found; ++pass) {
+            for (int p = 1; p <= plies && !found && threatNodes < threatBudget; p += 2) {
+                found = attackerWins(0, p, pass == 1, result.move);
+                result.depth = p;
+            }
+        }
+        result.score = moveX ? inf : -inf;
+        result.threatNodes = threatNodes;
+        result.threatSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return found;
+    }
+
+    // Counts a solver node; once cancelled or past the deadline the budget is cut
+    // to the nodes spent.
+    bool threatOutOfBudget() {
+        ++threatNodes;
+        if ((cancel != nullptr && cancel->load(std::memory_order_relaxed))
+            || (threatNodes % checkThreatsEvery == 0 && threatDeadline != std::chrono::steady_clock::time_point::max()
+                && std::chrono::steady_clock::now() >= threatDeadline)) {
+            threatBudget = threatNodes - 1;
+        }
+        return threatNodes > threatBudget;
+    }
+
+    // Candidate cells where either player would make a three or more, with the
+    // patterns each would make. A cell's patterns depend only on the lines through
+    // it, so below the root a node takes its parent's cells and rescans just those
+    // on the lines through the last move.
+    const std::vector<threatCell>& collectThreats(int depth) {
+        std::vector<threatCell>& cells = threatCells[depth];
+        cells.clear();
+        if (depth == 0) {
+            for (int idx : candidates) {
+                int x, y;
+                board.coords(idx, x, y);
+                addThreatCell(cells, x, y);
+            }
+            return cells;
+        }
+        for (const auto& c : threatCells[depth - 1]) {
+            int dx = std::abs(c.move.first - lastX), dy = std::abs(c.move.second - lastY);
+            if (!((dx == 0 || dy == 0 || dx == dy) && std::max(dx, dy) <= toWin)) {
+                cells.push_back(c);
+            }
+        }
+        for (int d = 0; d < DIRECTIONS; ++d) {
+            for (int k = -toWin; k <= toWin; ++k) {
+                int x = lastX + k * DIR_X[d], y = lastY + k * DIR_Y[d];
+                if (k != 0 && board.inside(x, y) && board.at(x, y) == EMPTY && candidateSlot[board.index(x, y)] >= 0) {
+                    addThreatCell(cells, x, y);
                 }
             }
         }
-        return moves;
+        return cells;
+    }
+
+    void addThreatCell(std::vector<threatCell>& cells, int x, int y) {
+        threatCell c = {{x, y}, {createdPatterns(x, y, CROSS), createdPatterns(x, y, NOUGHT)}};
+        for (uint8_t player = CROSS; player <= NOUGHT; ++player) {
+            uint64_t threats = groupMask[0][player] | groupMask[1][player] | groupMask[2][player] | groupMask[3][player];
+            if (c.made[player - 1] & threats) {
+                cells.push_back(c);
+                return;
+            }
+        }
     }
 
-    bool moveIfCanWin(Game &machine) {
-        int x, y, miX, maX, miY, maY;
-        int lastEval = machine.positionEvaluation;
-        machine.getLastMove(x, y);
-        miX = lastMinX; miY = lastMinY; maX = lastMaxX; maY = lastMaxY;
-        for (const auto& curMove : machine.getAvailableMoves()) {
-            machine.move(curMove.first, curMove.second);
-            if (machine.checkWin()) {
-                move(curMove.first, curMove.second);
+    bool attackerWins(int depth, int plies, bool threes, std::pair<int, int>& win) {
+        if (threatOutOfBudget()) {
+            return false;
+        }
+        uint8_t me = moveX ? CROSS : NOUGHT, opponent = moveX ? NOUGHT : CROSS;
+        std::vector<moveWithEval>& moves = moveBuffer(depth);
+        moves.clear();
+        int blocks = 0;
+        std::pair<int, int> block;
+        for (const auto& c : collectThreats(depth)) {
+            uint64_t mine = c.made[me - 1], theirs = c.made[opponent - 1];
+            if (mine & groupMask[0][me]) {
+                win = c.move;
                 return true;
             }
-            machine.revert(x, y, miX, miY, maX, maY, lastEval);
+            if (theirs & groupMask[0][opponent]) {
+                ++blocks;
+                block = c.move;
+            }
+            int eval = (mine & (groupMask[1][me] | groupMask[2][me])) ? 2 : (threes && (mine & groupMask[3][me])) ? 1 : 0;
+            if (eval > 0) {
+                moves.push_back({c.move, eval});
+            }
+        }
+        if (plies <= 0 || blocks > 1) {
+            return false;
+        }
+        // only threats, and only the block if the defender threatens five
+        if (blocks == 1) {
+            moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const moveWithEval& m) {
+                return m.move != block;
+            }), moves.end());
+        }
+        std::sort(moves.begin(), moves.end(), [](const moveWithEval& a, const moveWithEval& b) {
+            return a.eval > b.eval;
+        });
+        for (const auto& m : moves) {
+            makeMove(m.move.first, m.move.second);
+            bool wins = defenderLoses(depth + 1, plies - 1, threes);
+            unmakeMove();
+            if (wins) {
+                win = m.move;
+                return true;
+            }
+            if (threatNodes > threatBudget) {
+                break;
+            }
         }
         return false;
     }
 
-    int getBestScore(Game &machine, int depth, std::pair<int, int>& nextMove, int alpha, int beta) {
-        if (machine.positionEvaluation >= inf) {
-            return inf;
-        } else if (machine.positionEvaluation <= -inf) {
-            return -inf;
-        } else if (depth >= maxDepth) {
+    bool defenderLoses(int depth, int plies, bool threes) {
+        if (threatOutOfBudget()) {
+            return false;
+        }
+        uint8_t me = moveX ? CROSS : NOUGHT, attacker = moveX ? NOUGHT : CROSS;
+        std::vector<moveWithEval>& moves = moveBuffer(depth);
+        moves.clear();
+        int fives = 0;
+        std::pair<int, int> block;
+        for (const auto& c : collectThreats(depth)) {
+            uint64_t mine = c.made[me - 1], theirs = c.made[attacker - 1];
+            if (mine & groupMask[0][me]) {
+                return false;
+            }
+            if (theirs & groupMask[0][attacker]) {
+                ++fives;
+                block = c.move;
+            }
+            // counter-fours first, they refute fastest, then blocks of the attacker's
+            // next four, then counter-threes
+            if (mine & (groupMask[1][me] | groupMask[2][me])) {
+                moves.push_back({c.move, 2});
+            } else if (theirs & (groupMask[1][attacker] | groupMask[2][attacker])) {
+                moves.push_back({c.move, 1});
+            } else if (mine & groupMask[3][me]) {
+                moves.push_back({c.move, 0});
+            }
+        }
+        if (fives > 1) {
+            return true;
+        }
+        if (fives == 1) {
+            moves.assign(1, {block, 1});
+        } else if (!threes) {
+            moves.clear();
+        }
+        if (moves.empty()) {
+            return false; // the last attack was no threat
+        }
+        std::sort(moves.begin(), moves.end(), [](const moveWithEval& a, const moveWithEval& b) {
+            return a.eval > b.eval;
+        });
+        std::pair<int, int> unused;
+        for (const auto& m : moves) {
+            makeMove(m.move.first, m.move.second);
+            bool lost = attackerWins(depth + 1, plies - 1, threes, unused);
+            unmakeMove();
+            if (!lost) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Lazy SMP: every thread runs iterative deepening on its own copy of the position
+    // and they share only the transposition table. Helper threads start one ply
+    // deeper on odd ids and differ in move order, so they fill the table with results
+    // the main thread picks up. The deepest completed iteration wins. Helpers poll
+    // the stop flag at every node, so joining them once thread 0 stops is quick.
+    searchResult search(Game &machine, const searchLimits& limits, std::chrono::steady_clock::time_point until) {
+        auto start = std::chrono::steady_clock::now();
+        searchShared state;
+        int threads = std::max(1, limits.threads);
+        std::vector<Game> helpers(threads - 1, machine);
+        for (int i = 1; i < threads; ++i) {
+            helpers[i - 1].setSeed(machine.rng() + i);
+            TTT_COUNT(helpers[i - 1].stats = searchStats();)
+        }
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; ++i) {
+            pool.emplace_back([&, i] {
+                Game& helper = helpers[i - 1];
+                helper.iterativeDeepening(helper, limits, until, state, i);
+            });
+        }
+        searchResult result = machine.iterativeDeepening(machine, limits, until, state, 0);
+        state.stop = true;
+        for (auto& t : pool) {
+            t.join();
+        }
+        TTT_COUNT(for (const auto& h : helpers) machine.stats.add(h.stats);)
+        if (state.best.depth > result.depth) {
+            result = state.best;
+        }
+        result.nodes = state.nodes;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Runs getBestScore at depth 1, 2, ... until a limit is hit or the search is
+    // stopped, keeping the result of the last completed iteration, which is also
+    // published to the other threads. Every thread watches the deadline; thread 0
+    // also the cancel flag and the node limit. The node limit lets its first
+    // iteration complete; the deadline and cancel do not, and then the best root
+    // move found so far is played.
+    searchResult iterativeDeepening(Game &machine, const searchLimits& limits,
+                                    std::chrono::steady_clock::time_point until, searchShared& state, int id) {
+        auto start = std::chrono::steady_clock::now();
+        searchResult result;
+        shared = &state;
+        cancel = limits.cancel;
+        searchId = id;
+        nodes = 0;
+        nodeLimit = limits.nodes;
+        timed = limits.milliseconds > 0;
+        deadline = until;
+        stopped = false;
+        pruneThreats = limits.threatPruning;
+        pvLine.clear();
+        rootMove = {-1, -1};
+        ttCounts = ttCounters();
+        std::fill(history.begin(), history.end(), 0);
+        reserveSearch();
+        int depthLimit = limits.depth > 0 ? std::min(limits.depth, maxDepth) : maxDepth;
+        for (int d = 1 + id % 2; d <= depthLimit; ++d) {
+            searchDepth = d;
+            std::pair<int, int> nextMove;
+            TTT_COUNT(uint64_t iterationStart = nowMicros();)
+            int score;
+            {
+                TTT_PHASE(stats, PHASE_SEARCH);
+                score = getBestScore(machine, 0, nextMove, -inf, inf, true);
+            }
+            TTT_COUNT(stats.span("depth " + std::to_string(d), id, iterationStart);)
+            if (stopped) {
+                break;
+            }
+            result.move = nextMove;
+            result.score = score;
+            result.depth = d;
+            result.pv = principalVariation(machine, nextMove, d);
+            pvLine = result.pv;
+            state.publish(result);
+            if (id == 0 && limits.progress) {
+                searchResult report = result;
+                report.nodes = state.nodes + nodes % publishEvery;
+                report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                limits.progress(report);
+            }
+            if (score >= inf || score <= -inf) {
+                break;
+            }
+        }
+        if (result.move.first < 0) {
+            result.move = rootMove; // stopped during the first iteration
+        }
+        state.nodes += nodes % publishEvery;
+        table->addCounts(ttCounts);
+        shared = nullptr;
+        return result;
+    }
+
+    // Follows stored best moves from the root, starting with its best move.
+    std::vector<std::pair<int, int>> principalVariation(Game &machine, std::pair<int, int> first, int length) {
+        std::vector<std::pair<int, int>> line;
+        std::pair<int, int> next = first;
+        ttEntry entry;
+        while ((int)line.size() < length && machine.isFree(next.first, next.second)) {
+            line.push_back(next);
+            machine.makeMove(next.first, next.second);
+            if (!table->probe(machine.getHash(), entry)) {
+                break;
+            }
+            next = {entry.moveX, entry.moveY};
+        }
+        for (size_t i = 0; i < line.size(); ++i) {
+            machine.unmakeMove();
+        }
+        return line;
+    }
+
+    // Stops at once when another thread has stopped the search. Polls the limits
+    // every checkEvery nodes and publishes the node count every publishEvery nodes.
+    bool outOfBudget() {
+        if (stopped || shared->stop.load(std::memory_order_relaxed)) {
+            stopped = true;
+            return true;
+        }
+        if (nodes % checkEvery != 0) {
+            return false;
+        }
+        if (nodes % publishEvery == 0) {
+            shared->nodes += publishEvery;
+        }
+        bool over = timed && std::chrono::steady_clock::now() >= deadline;
+        if (searchId == 0) {
+            over = over || (cancel != nullptr && *cancel)
+                || (nodeLimit != 0 && searchDepth > 1 && shared->nodes >= nodeLimit);
+        }
+        if (over) {
+            stopped = true;
+            shared->stop = true;
+        }
+        return stopped;
+    }
+
+    int getBestScore(Game &machine, int depth, std::pair<int, int>& nextMove, int alpha, int beta, bool pvNode) {
+        ++nodes;
+        TTT_COUNT(++machine.stats.nodes[depth];)
+        if (outOfBudget() && depth > 0) {
+            return 0; // the root still orders its moves, for a move to fall back on
+        }
+        if (machine.lastMoveWins()) {
+            return machine.isMoveX() ? -inf : inf; // won by the side that just moved
+        } else if (depth >= searchDepth) {
             return std::min(inf, std::max(-inf, machine.positionEvaluation));
         }
-        int x, y, score;
-        int miX, maX, miY, maY;
-        int lastEval = machine.positionEvaluation;
-        machine.getLastMove(x, y);
-        miX = lastMinX; miY = lastMinY; maX = lastMaxX; maY = lastMaxY;
+        int remaining = searchDepth - depth;
+        int alphaOrig = alpha, betaOrig = beta;
+        uint64_t key = machine.getHash();
+        ttEntry entry = {};
+        bool found = table->probe(key, entry, ttCounts);
+        TTT_COUNT(++machine.stats.ttProbes; machine.stats.ttHits += found;)
+        if (analysis && remaining >= ANALYSIS_MIN_DEPTH && (!found || entry.depth < remaining)) {
+            // results of earlier runs and other processes
+            ttEntry stored;
+            if (analysis->probe(key ^ configKey, stored) && (!found || stored.depth > entry.depth)) {
+                entry = stored;
+                found = true;
+                table->store(key, entry.depth, entry.bound, entry.score, entry.moveX, entry.moveY);
+            }
+        }
+        if (found && depth > 0 && entry.depth >= remaining) {
+            if (entry.bound == BOUND_EXACT) {
+                TTT_COUNT(++machine.stats.ttCutoffs;)
+                return entry.score;
+            } else if (entry.bound == BOUND_LOWER) {
+                alpha = std::max(alpha, entry.score);
+            } else if (entry.bound == BOUND_UPPER) {
+                beta = std::min(beta, entry.score);
+            }
+            if (alpha >= beta) {
+                TTT_COUNT(++machine.stats.ttCutoffs;)
+                return entry.score;
+            }
+        }
+        int score;
         int bestScore = machine.isMoveX() ? -inf : inf;
-        std::vector<std::pair<int, int>> moves = machine.getAvailableMoves();
-        std::random_device rd;
-        std::mt19937 g(rd());
-        std::shuffle(moves.begin(), moves.end(), g);
-        std::pair<int, int> bestMove = moves[0];
-
-        for (const auto& move : moves) {
-            machine.move(move.first, move.second);
-            score = getBestScore(machine, depth + 1, nextMove, alpha, beta);
-            machine.revert(x, y, miX, miY, maX, maY, lastEval);
+        std::vector<moveWithEval>& moves = machine.moveBuffer(depth);
+        machine.getAvailableMoves(moves);
+        // try the previous iteration's line, then the stored best move first
+        pvNode = pvNode && depth < (int)pvLine.size();
+        std::pair<int, int> first = pvNode ? pvLine[depth] : found ? std::make_pair(entry.moveX, entry.moveY) : std::make_pair(-1, -1);
+        machine.orderMoves(moves, depth, first, pruneThreats);
+        if (moves.empty()) {
+            return std::min(inf, std::max(-inf, machine.positionEvaluation));
+        }
+        pvNode = pvNode && moves[0].move == first;
+        std::pair<int, int> bestMove = moves[0].move;
+        if (depth == 0) {
+            rootMove = bestMove;
+        }
+
+        for (const auto& m : moves) {
+            const auto& move = m.move;
+            machine.makeMove(move.first, move.second);
+            score = getBestScore(machine, depth + 1, nextMove, alpha, beta, pvNode && move == moves[0].move);
+            machine.unmakeMove();
+            if (stopped) {
+                return 0;
+            }
             if (machine.isMoveX()) {
                 if (score > bestScore) {
                     bestScore = score;
@@ -436,10 +1489,20 @@ private:
                 }
                 beta = std::min(beta, bestScore);
             }
+            if (depth == 0) {
+                rootMove = bestMove;
+            }
             if (alpha >= beta) {
+                machine.recordCutoff(move, depth, remaining);
+                TTT_COUNT(machine.stats.cutoff(&m - moves.data());)
                 break;
             }
         }
+        Bound bound = bestScore <= alphaOrig ? BOUND_UPPER : bestScore >= betaOrig ? BOUND_LOWER : BOUND_EXACT;
+        table->store(key, remaining, bound, bestScore, bestMove.first, bestMove.second);
+        if (analysis && remaining >= ANALYSIS_MIN_DEPTH) {
+            analysis->store(key ^ configKey, remaining, bound, bestScore, bestMove.first, bestMove.second);
+        }
         nextMove = bestMove;
         return bestScore;
     }
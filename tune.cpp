@@ -0,0 +1,442 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ttt.h"
+
+// Texel-style tuning of the pattern group weights over recorded games. Every
+// position after the opening is labelled with its game's outcome (1 for an X win,
+// 0.5 for a draw, 0 for an O win) and the weights are fitted so that
+// sigmoid(evaluation) predicts the labels with the least squared error:
+//     ./arena --games 20000 --a depth=2 --b depth=2 --log games.csv
+//     g++ -O2 tune.cpp -o tune -pthread && ./tune games.csv --out weights.txt
+// The evaluation is linear in the weights, so each position is reduced once to
+// its pattern counts and the fit itself never touches a board.
+
+// Pattern counts of a position: for group g >= 1, [2 * (g - 1)] counts patterns
+// occurring once and [2 * (g - 1) + 1] patterns occurring again, X's minus O's.
+const int FEATURES = 2 * (WEIGHT_GROUPS - 1);
+typedef std::array<int, FEATURES> features;
+
+struct tuneOptions {
+    int boardSize = 15;
+    int toWin = 5;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int skip = 4;           // opening plies left out of the data
+    int iterations = 2000;
+    double rate = 2;        // Adam step size, in weight units
+    std::string start;      // initial weights file, compiled-in weights if empty
+    std::string out = DEFAULT_WEIGHTS_FILE;
+    std::vector<std::string> logs;
+};
+
+struct dataset {
+    std::vector<features> positions;
+    std::vector<float> results; // from X's point of view
+};
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [options] LOG.csv...\n"
+              << "  --size N        board size of the games (default 15)\n"
+              << "  --win N         stones in a row to win, 3 to 5 (default 5)\n"
+              << "  --threads N     threads (default: all cores)\n"
+              << "  --skip N        plies left out at the start of every game (default 4)\n"
+              << "  --iterations N  gradient steps (default 2000)\n"
+              << "  --rate R        step size (default 2)\n"
+              << "  --start FILE    initial weights\n"
+              << "  --out FILE      tuned weights (default " << DEFAULT_WEIGHTS_FILE << ")\n";
+}
+
+bool parseOptions(int argc, char** argv, tuneOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            options.logs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--size") {
+            options.boardSize = std::atoi(value);
+        } else if (arg == "--win") {
+            options.toWin = std::atoi(value);
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value));
+        } else if (arg == "--skip") {
+            options.skip = std::max(0, std::atoi(value));
+        } else if (arg == "--iterations") {
+            options.iterations = std::max(0, std::atoi(value));
+        } else if (arg == "--rate") {
+            options.rate = std::atof(value);
+        } else if (arg == "--start") {
+            options.start = value;
+        } else if (arg == "--out") {
+            options.out = value;
+        } else {
+            return false;
+        }
+    }
+    return !options.logs.empty() && options.boardSize > 0 && options.toWin >= MIN_WIN && options.toWin <= MAX_WIN;
+}
+
+// Fields of a CSV line; quoted fields may contain commas.
+std::vector<std::string> splitCsv(const std::string& line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == ',' && !quoted) {
+            fields.emplace_back();
+        } else {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+struct recordedGame {
+    std::vector<std::pair<int, int>> moves;
+    float result;
+};
+
+// Games of an arena log: the "moves" and "result" columns.
+bool readGames(const std::string& path, std::vector<recordedGame>& games) {
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line)) {
+        return false;
+    }
+    std::vector<std::string> header = splitCsv(line);
+    int movesColumn = std::find(header.begin(), header.end(), "moves") - header.begin();
+    int resultColumn = std::find(header.begin(), header.end(), "result") - header.begin();
+    if (movesColumn == (int)header.size() || resultColumn == (int)header.size()) {
+        return false;
+    }
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields = splitCsv(line);
+        if (fields.size() != header.size()) {
+            continue;
+        }
+        const std::string& result = fields[resultColumn];
+        recordedGame game;
+        game.result = result == "1-0" ? 1 : result == "0-1" ? 0 : 0.5f;
+        std::stringstream in(fields[movesColumn]);
+        std::string token;
+        while (in >> token) {
+            int x, y;
+            char comma;
+            std::stringstream coords(token);
+            if (!(coords >> x >> comma >> y)) {
+                return false;
+            }
+            game.moves.push_back({x, y});
+        }
+        games.push_back(std::move(game));
+    }
+    return true;
+}
+
+// Reaches into Game for the pattern hits of a move; a friend of Game.
+class Tuner {
+public:
+    // Adds sign times the patterns of h to f; false if a five is among them.
+    static bool addHits(const Game& game, const hits& h, int sign, features& f) {
+        for (uint64_t m = h.once; m != 0; m &= m - 1) {
+            int i = __builtin_ctzll(m);
+            const pattern& p = game.patterns[i];
+            if (p.group == 0) {
+                return false;
+            }
+            f[2 * (p.group - 1) + (h.more >> i & 1)] += p.once > 0 ? sign : -sign;
+        }
+        return true;
+    }
+
+    // Replays a game, recording the counts of every position after `skip` plies
+    // up to the last one before a five. Returns the number of positions whose
+    // counts disagree with the engine's own evaluation, which should be none.
+    static int extract(Game& game, const recordedGame& record, int skip, dataset& data) {
+        features f = {};
+        int mismatches = 0;
+        for (size_t ply = 0; ply < record.moves.size(); ++ply) {
+            int x = record.moves[ply].first, y = record.moves[ply].second;
+            if (!game.isFree(x, y)) {
+                break;
+            }
+            bool open = addHits(game, game.moveHits(x, y), -1, f);
+            game.move(x, y);
+            open = addHits(game, game.moveHits(x, y), 1, f) && open;
+            if (!open || game.checkWin()) {
+                break;
+            }
+            if ((int)ply + 1 < skip) {
+                continue;
+            }
+            int evaluation = 0;
+            for (int k = 0; k < FEATURES; ++k) {
+                const std::pair<int, int>& w = game.group[k / 2 + 1];
+                evaluation += f[k] * (k % 2 ? w.second : w.first);
+            }
+            mismatches += evaluation != game.positionEvaluation;
+            data.positions.push_back(f);
+            data.results.push_back(record.result);
+        }
+        while (game.undo()) {}
+        return mismatches;
+    }
+};
+
+double sigmoid(double scaled) {
+    return 1 / (1 + std::exp(-scaled));
+}
+
+double evaluate(const features& f, const std::vector<double>& weights) {
+    double e = 0;
+    for (int k = 0; k < FEATURES; ++k) {
+        e += f[k] * weights[k];
+    }
+    return e;
+}
+
+// Mean squared error of sigmoid(scale * evaluation) and, if gradient is given,
+// its gradient over the weights. Positions are split among worker threads that
+// are started once and wait between calls, as a fit makes thousands of them.
+class MeanError {
+public:
+    MeanError(const dataset& data, int threads)
+        : data(data), errors(threads, 0), gradients(threads, std::vector<double>(FEATURES, 0)) {
+        for (int t = 1; t < threads; ++t) {
+            workers.emplace_back([this, t]() {
+                work(t);
+            });
+        }
+    }
+
+    MeanError(const MeanError&) = delete;
+    MeanError& operator=(const MeanError&) = delete;
+
+    ~MeanError() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+            ++round;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    double operator()(const std::vector<double>& w, double s, std::vector<double>* gradient = nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            weights = &w;
+            scale = s;
+            withGradient = gradient != nullptr;
+            pending = workers.size();
+            ++round;
+        }
+        wake.notify_all();
+        evaluate(0); // the calling thread takes the first slice
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() {
+                return pending == 0;
+            });
+        }
+        size_t n = data.positions.size();
+        double error = 0;
+        for (double e : errors) {
+            error += e;
+        }
+        if (gradient != nullptr) {
+            gradient->assign(FEATURES, 0);
+            for (const auto& g : gradients) {
+                for (int k = 0; k < FEATURES; ++k) {
+                    (*gradient)[k] += g[k] / n;
+                }
+            }
+        }
+        return error / n;
+    }
+
+private:
+    const dataset& data;
+    std::vector<double> errors;
+    std::vector<std::vector<double>> gradients;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    uint64_t round = 0; // bumped for every call, and to quit
+    size_t pending = 0; // workers still evaluating this round
+    bool quit = false;
+    // arguments of the current round
+    const std::vector<double>* weights = nullptr;
+    double scale = 0;
+    bool withGradient = false;
+
+    void work(int t) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() {
+                    return round != seen;
+                });
+                seen = round;
+                if (quit) {
+                    return;
+                }
+            }
+            evaluate(t);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    // Error and gradient over slice t of the positions.
+    void evaluate(int t) {
+        size_t n = data.positions.size(), threads = errors.size();
+        size_t first = n * t / threads, last = n * (t + 1) / threads;
+        double error = 0;
+        std::vector<double>& g = gradients[t];
+        std::fill(g.begin(), g.end(), 0);
+        for (size_t i = first; i < last; ++i) {
+            const features& f = data.positions[i];
+            double p = sigmoid(scale * ::evaluate(f, *weights));
+            double d = p - data.results[i];
+            error += d * d;
+            if (withGradient) {
+                double common = 2 * d * p * (1 - p) * scale;
+                for (int k = 0; k < FEATURES; ++k) {
+                    g[k] += common * f[k];
+                }
+            }
+        }
+        errors[t] = error;
+    }
+};
+
+// Scale of the evaluation that best fits the labels with the starting weights,
+// by golden-section search on a log scale.
+double fitScale(MeanError& meanError, const std::vector<double>& weights) {
+    const double phi = (std::sqrt(5.0) - 1) / 2;
+    double lo = std::log(1e-5), hi = std::log(1.0);
+    for (int i = 0; i < 40; ++i) {
+        double a = hi - phi * (hi - lo), b = lo + phi * (hi - lo);
+        if (meanError(weights, std::exp(a)) < meanError(weights, std::exp(b))) {
+            hi = b;
+        } else {
+            lo = a;
+        }
+    }
+    return std::exp((lo + hi) / 2);
+}
+
+int main(int argc, char** argv) {
+    tuneOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::vector<recordedGame> games;
+    for (const auto& path : options.logs) {
+        if (!readGames(path, games)) {
+            std::cerr << "cannot read games from " << path << std::endl;
+            return 1;
+        }
+    }
+    Game prototype(options.boardSize, options.toWin);
+    prototype.setHashSize(1);
+    if (!options.start.empty() && !prototype.loadWeights(options.start)) {
+        std::cerr << "cannot read weights from " << options.start << std::endl;
+        return 1;
+    }
+
+    // features of all positions, games split among threads
+    auto start = std::chrono::steady_clock::now();
+    std::vector<dataset> parts(options.threads);
+    std::vector<int> mismatches(options.threads, 0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < options.threads; ++t) {
+        pool.emplace_back([&, t]() {
+            Game game(prototype);
+            for (size_t i = t; i < games.size(); i += options.threads) {
+                mismatches[t] += Tuner::extract(game, games[i], options.skip, parts[t]);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    dataset data;
+    int mismatched = 0;
+    for (int t = 0; t < options.threads; ++t) {
+        data.positions.insert(data.positions.end(), parts[t].positions.begin(), parts[t].positions.end());
+        data.results.insert(data.results.end(), parts[t].results.begin(), parts[t].results.end());
+        mismatched += mismatches[t];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << games.size() << " games, " << data.positions.size() << " positions in " << seconds << "s" << std::endl;
+    if (mismatched > 0) {
+        std::cerr << "warning: " << mismatched << " positions disagree with the engine's evaluation" << std::endl;
+    }
+    if (data.positions.empty()) {
+        std::cerr << "no positions to tune on" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<int, int>> initial = prototype.getWeights();
+    std::vector<double> weights(FEATURES);
+    for (int k = 0; k < FEATURES; ++k) {
+        weights[k] = k % 2 ? initial[k / 2 + 1].second : initial[k / 2 + 1].first;
+    }
+    MeanError meanError(data, options.threads);
+    double scale = fitScale(meanError, weights);
+    double initialError = meanError(weights, scale);
+    std::cerr << "scale " << scale << ", initial error " << initialError << std::endl;
+
+    // Adam; weights stay non-negative so that threats keep their sign
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-12;
+    std::vector<double> gradient, m(FEATURES, 0), v(FEATURES, 0);
+    double error = initialError;
+    start = std::chrono::steady_clock::now();
+    for (int it = 1; it <= options.iterations; ++it) {
+        error = meanError(weights, scale, &gradient);
+        for (int k = 0; k < FEATURES; ++k) {
+            m[k] = beta1 * m[k] + (1 - beta1) * gradient[k];
+            v[k] = beta2 * v[k] + (1 - beta2) * gradient[k] * gradient[k];
+            double mHat = m[k] / (1 - std::pow(beta1, it)), vHat = v[k] / (1 - std::pow(beta2, it));
+            weights[k] = std::max(0.0, weights[k] - options.rate * mHat / (std::sqrt(vHat) + epsilon));
+        }
+        if (it % 200 == 0) {
+            std::cerr << "iteration " << it << ": error " << error << std::endl;
+        }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<std::pair<int, int>> tuned = initial;
+    for (int g = 1; g < WEIGHT_GROUPS; ++g) {
+        tuned[g] = {int(std::lround(weights[2 * (g - 1)])), int(std::lround(weights[2 * (g - 1) + 1]))};
+        std::cerr << GROUP_NAMES[g] << ": " << initial[g].first << " " << initial[g].second
+                  << " -> " << tuned[g].first << " " << tuned[g].second << std::endl;
+    }
+    std::cerr << "error " << initialError << " -> " << error << " in " << seconds << "s" << std::endl;
+    if (!writeWeights(options.out, tuned)) {
+        std::cerr << "cannot write " << options.out << std::endl;
+        return 1;
+    }
+    return 0;
+}
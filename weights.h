@@ -0,0 +1,56 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Evaluation weights of the pattern groups, as (once, more) pairs: the score of a
+// pattern occurring once in the lines through a move, and occurring again. Group 0,
+// five in a row, is always a win and is not stored.
+//
+// Weights files are plain text, one group per line, '#' starting a comment:
+//     open-four 1000 1300
+//     four 80 180
+// Groups that are not listed keep their current weights.
+
+const int WEIGHT_GROUPS = 5;
+const char* const GROUP_NAMES[WEIGHT_GROUPS] = {"five", "open-four", "four", "open-three", "two"};
+
+// Loaded at startup by the front ends when present in the working directory.
+const char* const DEFAULT_WEIGHTS_FILE = "weights.txt";
+
+inline bool readWeights(const std::string& path, std::vector<std::pair<int, int>>& weights) {
+    std::ifstream file(path);
+    if (!file || weights.size() != WEIGHT_GROUPS) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream in(line);
+        std::string name;
+        if (!(in >> name)) {
+            continue;
+        }
+        int g = 1;
+        while (g < WEIGHT_GROUPS && name != GROUP_NAMES[g]) {
+            ++g;
+        }
+        int once, more;
+        if (g == WEIGHT_GROUPS || !(in >> once >> more)) {
+            return false;
+        }
+        weights[g] = {once, more};
+    }
+    return true;
+}
+
+inline bool writeWeights(const std::string& path, const std::vector<std::pair<int, int>>& weights) {
+    std::ofstream file(path);
+    file << "# group once more\n";
+    for (int g = 1; g < WEIGHT_GROUPS && g < (int)weights.size(); ++g) {
+        file << GROUP_NAMES[g] << " " << weights[g].first << " " << weights[g].second << "\n";
+    }
+    return bool(file);
+}